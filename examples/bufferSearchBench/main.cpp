@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include "eloop/buffer.hpp"
+
+using namespace eloop;
+
+// keeps results alive so the searches are not optimized out
+size_t sink = 0;
+
+double gbPerSec(std::chrono::steady_clock::time_point start, size_t bytes)
+{
+    std::chrono::duration<double> s = std::chrono::steady_clock::now() - start;
+    return static_cast<double>(bytes) / s.count() / 1e9;
+}
+
+// header-like text without the searched delimiters, which are put
+// at the very end so every search walks the whole payload
+std::string payload(size_t size)
+{
+    static const char alphabet[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_/.";
+    std::mt19937 rng(static_cast<unsigned>(size));
+    std::string text(size, 'x');
+    for (auto &c: text)
+        c = alphabet[rng() % (sizeof(alphabet) - 1)];
+    memcpy(&text[size - 4], "\r\n\r\n", 4);
+    return text;
+}
+
+template<typename F>
+double measure(size_t size, F &&search)
+{
+    const size_t rounds = std::max<size_t>(1, (256 << 20) / size);
+    auto t = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; i++)
+        sink += search();
+    return gbPerSec(t, rounds * size);
+}
+
+void searches(size_t size)
+{
+    std::string text = payload(size);
+    Buffer buf;
+    buf.append(text);
+    const char *begin = buf.peek();
+    const char *end = buf.beginWrite();
+    const std::string crlf("\r\n");
+    const std::string crlfcrlf("\r\n\r\n");
+    const std::string set(":;\r\n");
+
+    double naive = measure(size, [&] {
+        return std::search(begin, end, crlfcrlf.begin(), crlfcrlf.end())
+            - begin;
+    });
+    double simd = measure(size, [&] {
+        return buf.find(crlfcrlf) - begin;
+    });
+    printf("%8lu %-22s %10.2f %10.2f\n",
+        size, "\"\\r\\n\\r\\n\"", naive, simd);
+
+    naive = measure(size, [&] {
+        return std::search(begin, end, crlf.begin(), crlf.end()) - begin;
+    });
+    simd = measure(size, [&] {
+        return buf.findCRLF() - begin;
+    });
+    printf("%8lu %-22s %10.2f %10.2f\n", size, "findCRLF", naive, simd);
+
+    naive = measure(size, [&] {
+        return std::find_first_of(begin, end, set.begin(), set.end())
+            - begin;
+    });
+    simd = measure(size, [&] {
+        return buf.findAnyOf(set) - begin;
+    });
+    printf("%8lu %-22s %10.2f %10.2f\n",
+        size, "anyOf \":;\\r\\n\"", naive, simd);
+
+    naive = measure(size, [&] {
+        return std::find(begin, end, '\n') - begin;
+    });
+    simd = measure(size, [&] {
+        return buf.find('\n') - begin;
+    });
+    printf("%8lu %-22s %10.2f %10.2f\n", size, "'\\n'", naive, simd);
+}
+
+// a message of size bytes arriving chunk bytes at a time, searched for
+// its terminator after every read
+void arrival(size_t size, size_t chunk)
+{
+    std::string text = payload(size);
+    const std::string crlfcrlf("\r\n\r\n");
+
+    double rescan = measure(size, [&] {
+        Buffer buf;
+        const char *hit = nullptr;
+        for (size_t off = 0; hit == nullptr; off += chunk)
+        {
+            buf.append(text.data() + off, std::min(chunk, size - off));
+            hit = buf.find(crlfcrlf);
+        }
+        return static_cast<size_t>(hit - buf.peek());
+    });
+    double resume = measure(size, [&] {
+        Buffer buf;
+        const char *hit = nullptr;
+        for (size_t off = 0; hit == nullptr; off += chunk)
+        {
+            buf.append(text.data() + off, std::min(chunk, size - off));
+            hit = buf.scan(crlfcrlf);
+        }
+        return static_cast<size_t>(hit - buf.peek());
+    });
+    printf("%8lu %-22s %10.2f %10.2f\n",
+        size, ("arrival/" + std::to_string(chunk)).c_str(), rescan, resume);
+}
+
+int main()
+{
+    printf("implementation: %s\n", bytes::implementation());
+    printf("%8s %-22s %10s %10s\n",
+        "bytes", "search", "std(GB/s)", "eloop(GB/s)");
+    for (size_t size: {64, 512, 4096, 65536})
+        searches(size);
+
+    printf("\n%8s %-22s %10s %10s\n", "bytes", "search", "rescan", "scan()");
+    for (size_t size: {4096, 65536})
+        arrival(size, 512);
+    return 0;
+}
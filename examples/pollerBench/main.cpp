@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "eloop/channel.hpp"
+#include "eloop/eventLoop.hpp"
+#include "eloop/ioUringPoller.hpp"
+
+using namespace eloop;
+
+struct Result
+{
+    double msgsPerSec;
+    double cpuUsPerMsg;
+};
+
+double threadCpuUs()
+{
+    struct rusage usage;
+    ::getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_utime.tv_sec * 1e6 + usage.ru_utime.tv_usec +
+        usage.ru_stime.tv_sec * 1e6 + usage.ru_stime.tv_usec;
+}
+
+// n connected loopback pairs, the server ends non-blocking
+void connectPairs(int n, std::vector<int> *clients, std::vector<int> *servers)
+{
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    ::bind(listener, reinterpret_cast<sockaddr*>(&addr), len);
+    ::listen(listener, n);
+    ::getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &len);
+    for (int i = 0; i < n; ++i)
+    {
+        int client = ::socket(AF_INET, SOCK_STREAM, 0);
+        ::connect(client, reinterpret_cast<sockaddr*>(&addr), len);
+        clients->push_back(client);
+        servers->push_back(::accept4(listener, nullptr, nullptr,
+            SOCK_NONBLOCK | SOCK_CLOEXEC));
+    }
+    ::close(listener);
+}
+
+// Echo size-byte messages on n connections for rounds rounds. Each
+// round the client writes one message on every connection, then reads
+// all the echoes back, so the loop sees n connections ready at once.
+Result run(const EventLoopOptions &options, int n, int rounds, size_t size)
+{
+    std::vector<int> clients, servers;
+    connectPairs(n, &clients, &servers);
+
+    EventLoop loop(options);
+    std::vector<std::unique_ptr<Channel>> channels;
+    int open = n;
+    char buf[64 * 1024];
+
+    auto closed = [&](Channel *channel)
+    {
+        channel->disableAll();
+        if(--open == 0)
+            loop.quit();
+    };
+
+    for (int fd: servers)
+    {
+        channels.emplace_back(new Channel(&loop, fd));
+        Channel *channel = channels.back().get();
+        if(loop.completionIO())
+        {
+            channel->setCompletion(
+                Channel::CompletionOp::kRecv,
+                [&, channel, fd](int res, const char *data)
+                {
+                    if(res > 0)
+                        ::write(fd, data, static_cast<size_t>(res));
+                    else
+                        closed(channel);
+                }
+            );
+        }
+        else
+        {
+            channel->setReadCallback([&, channel, fd]()
+            {
+                ssize_t len = ::read(fd, buf, sizeof(buf));
+                if(len > 0)
+                    ::write(fd, buf, static_cast<size_t>(len));
+                else
+                    closed(channel);
+            });
+        }
+        channel->enableRead();
+    }
+
+    std::thread client([&]()
+    {
+        std::vector<char> message(size, 'x');
+        std::vector<char> echo(size);
+        for (int round = 0; round < rounds; ++round)
+        {
+            for (int fd: clients)
+                ::write(fd, message.data(), size);
+            for (int fd: clients)
+            {
+                size_t got = 0;
+                while (got < size)
+                {
+                    ssize_t len = ::read(fd, echo.data() + got, size - got);
+                    if(len <= 0)
+                        return;
+                    got += static_cast<size_t>(len);
+                }
+            }
+        }
+        for (int fd: clients)
+            ::shutdown(fd, SHUT_WR);
+    });
+
+    double cpu = threadCpuUs();
+    auto start = std::chrono::steady_clock::now();
+    loop.loop();
+    std::chrono::duration<double> wall =
+        std::chrono::steady_clock::now() - start;
+    cpu = threadCpuUs() - cpu;
+    client.join();
+
+    channels.clear();
+    for (int fd: clients)
+        ::close(fd);
+    for (int fd: servers)
+        ::close(fd);
+
+    double messages = static_cast<double>(n) * rounds;
+    return {messages / wall.count(), cpu / messages};
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]): 10000;
+    size_t size = argc > 2 ? static_cast<size_t>(atoi(argv[2])): 64;
+
+    struct Backend
+    {
+        const char *name;
+        EventLoopOptions options;
+    };
+    std::vector<Backend> backends(1);
+    backends[0].name = "epoll";
+    if(IOUringPoller::supported())
+    {
+        backends.resize(3);
+        backends[1].name = "uring-poll";
+        backends[1].options.poller = PollerBackend::kIOUring;
+        backends[1].options.ioUringCompletions = false;
+        backends[2].name = "uring-recv";
+        backends[2].options.poller = PollerBackend::kIOUring;
+    }
+    else
+    {
+        printf("io_uring is not available, epoll only\n");
+    }
+
+    // runs of the backends are interleaved and the median kept, the
+    // client shares the machine with the loop and adds a lot of noise
+    const int runs = 5;
+    printf("echo of %lu-byte messages, %d rounds, median of %d runs\n",
+        size, rounds, runs);
+    printf("%6s %12s %12s %14s\n", "conns", "backend", "msgs/s",
+        "loop cpu(us)");
+    for (int n: {1, 16, 128})
+    {
+        // fewer rounds with more connections, about the same work
+        int r = std::max(1, rounds * 16 / std::max(n, 16));
+        std::vector<std::vector<Result>> results(backends.size());
+        for (int i = 0; i < runs; ++i)
+        {
+            for (size_t b = 0; b < backends.size(); ++b)
+                results[b].push_back(run(backends[b].options, n, r, size));
+        }
+        for (size_t b = 0; b < backends.size(); ++b)
+        {
+            auto &rs = results[b];
+            std::sort(rs.begin(), rs.end(),
+                [](const Result &x, const Result &y)
+                { return x.msgsPerSec < y.msgsPerSec; });
+            double msgs = rs[runs / 2].msgsPerSec;
+            std::sort(rs.begin(), rs.end(),
+                [](const Result &x, const Result &y)
+                { return x.cpuUsPerMsg < y.cpuUsPerMsg; });
+            printf("%6d %12s %12.0f %14.2f\n", n, backends[b].name,
+                msgs, rs[runs / 2].cpuUsPerMsg);
+        }
+    }
+    printf("\nloop cpu is the loop thread's CPU time per message\n");
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "eloop/callback.hpp"
+#include "eloop/mpscQueue.hpp"
+
+using namespace eloop;
+
+// The EventLoop::queueInLoop implementation before MPSCQueue.
+class MutexTaskQueue
+{
+public:
+    void push(Task &&task)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+
+    template<typename F>
+    size_t consume(F &&f)
+    {
+        std::vector<Task> tasks;
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            tasks.swap(tasks_);
+        }
+        for (auto &task: tasks)
+            f(task);
+        return tasks.size();
+    }
+private:
+    std::mutex mutex_;
+    std::vector<Task> tasks_;
+};
+
+template<typename Queue>
+double run(size_t numProducers, size_t tasksPerProducer)
+{
+    Queue queue;
+    size_t done = 0;
+    const size_t total = numProducers * tasksPerProducer;
+    std::atomic_bool go(false);
+
+    std::vector<std::thread> producers;
+    for (size_t i = 0; i < numProducers; i++)
+    {
+        producers.emplace_back(
+            [&]()
+            {
+                while (!go)
+                    ;
+                for (size_t j = 0; j < tasksPerProducer; j++)
+                    queue.push([&done]() { ++done; });
+            }
+        );
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    go = true;
+    while (done < total)
+        queue.consume([](Task &task) { task(); });
+    auto end = std::chrono::steady_clock::now();
+
+    for (auto &t: producers)
+        t.join();
+
+    std::chrono::duration<double> sec = end - start;
+    return static_cast<double>(total) / sec.count();
+}
+
+int main()
+{
+    const size_t tasksPerProducer = 200000;
+    printf("%10s %18s %18s %8s\n",
+        "producers", "mutex (tasks/s)", "mpsc (tasks/s)", "speedup");
+    for (size_t n: {1, 2, 4, 8, 16, 32})
+    {
+        double mutexRate = run<MutexTaskQueue>(n, tasksPerProducer);
+        double mpscRate = run<MPSCQueue<Task>>(n, tasksPerProducer);
+        printf("%10lu %18.0f %18.0f %7.2fx\n",
+            n, mutexRate, mpscRate, mpscRate / mutexRate);
+    }
+    return 0;
+}
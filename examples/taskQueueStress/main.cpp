@@ -0,0 +1,65 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <thread>
+#include <vector>
+#include "eloop/eventLoop.hpp"
+#include "eloop/eventLoopThread.hpp"
+
+using namespace eloop;
+
+// Producers queue one task each and wait for it to run before queueing
+// the next, so the loop is mostly asleep and every task depends on its
+// wakeup. A task the loop fails to pick up shows as a stall.
+int main(int argc, char *argv[])
+{
+    const size_t numProducers = argc > 1 ? atoi(argv[1]): 8;
+    const size_t rounds = argc > 2 ? atoi(argv[2]): 100000;
+    const auto stallAfter = std::chrono::seconds(1);
+
+    EventLoopThread loopThread;
+    EventLoop *loop = loopThread.startLoop();
+
+    std::atomic<size_t> stalls(0);
+    std::atomic<size_t> ran(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> producers;
+    for (size_t i = 0; i < numProducers; i++)
+    {
+        producers.emplace_back(
+            [&]()
+            {
+                for (size_t j = 0; j < rounds; j++)
+                {
+                    std::promise<void> done;
+                    loop->queueInLoop(
+                        [&]()
+                        {
+                            ++ran;
+                            done.set_value();
+                        }
+                    );
+                    auto future = done.get_future();
+                    if(future.wait_for(stallAfter) ==
+                       std::future_status::timeout)
+                    {
+                        // an unrelated task drains what was left behind
+                        ++stalls;
+                        loop->queueInLoop([](){});
+                        future.wait();
+                    }
+                }
+            }
+        );
+    }
+    for (auto &t: producers)
+        t.join();
+    std::chrono::duration<double> sec =
+        std::chrono::steady_clock::now() - start;
+
+    printf("producers=%lu tasks=%lu stalls=%lu %.0f tasks/s\n",
+        numProducers, ran.load(), stalls.load(), ran / sec.count());
+    return stalls == 0 ? 0: 1;
+}
@@ -0,0 +1,80 @@
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+#include "eloop/timerStore.hpp"
+#include "eloop/timingWheel.hpp"
+
+using namespace eloop;
+
+struct Result
+{
+    double insertNs;
+    double eraseNs;
+    double expireNs;
+};
+
+double nsPerOp(std::chrono::steady_clock::time_point start, size_t ops)
+{
+    std::chrono::duration<double, std::nano> ns =
+        std::chrono::steady_clock::now() - start;
+    return ns.count() / static_cast<double>(ops);
+}
+
+// insert n timers due within 60s, cancel half of them,
+// then expire the rest advancing time in 10ms steps
+Result run(TimerStore &store, MonoTimestamp start, size_t n)
+{
+    std::mt19937_64 rng(n);
+    std::vector<std::unique_ptr<Timer>> timers;
+    timers.reserve(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        Nanosecond delay(rng() % 60000000000ULL);
+        timers.emplace_back(new Timer(nullptr, start + delay, 0ns));
+    }
+
+    Result result;
+    auto t = std::chrono::steady_clock::now();
+    for (auto &timer: timers)
+        store.insert(timer.get());
+    result.insertNs = nsPerOp(t, n);
+
+    t = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i += 2)
+        store.erase(timers[i].get());
+    result.eraseNs = nsPerOp(t, n / 2);
+
+    std::vector<Timer*> expired;
+    size_t fired = 0;
+    t = std::chrono::steady_clock::now();
+    for (MonoTimestamp now = start; !store.empty(); now += 10ms)
+    {
+        expired.clear();
+        store.popExpired(now, expired);
+        fired += expired.size();
+    }
+    result.expireNs = nsPerOp(t, fired);
+    return result;
+}
+
+int main()
+{
+    printf("%9s %12s %12s %12s %12s\n",
+        "timers", "store", "insert(ns)", "cancel(ns)", "expire(ns)");
+    for (size_t n: {10000, 100000, 1000000})
+    {
+        MonoTimestamp start = clock::monoNow();
+        TimerSet set;
+        Result r = run(set, start, n);
+        printf("%9lu %12s %12.1f %12.1f %12.1f\n",
+            n, "set", r.insertNs, r.eraseNs, r.expireNs);
+
+        TimingWheel wheel(start, 1ms);
+        r = run(wheel, start, n);
+        printf("%9lu %12s %12.1f %12.1f %12.1f\n",
+            n, "wheel(1ms)", r.insertNs, r.eraseNs, r.expireNs);
+    }
+    return 0;
+}
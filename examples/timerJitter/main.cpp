@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "eloop/eventLoop.hpp"
+
+using namespace eloop;
+
+struct Config
+{
+    const char *name;
+    EventLoopOptions options;
+};
+
+double toUs(Nanosecond ns)
+{
+    return std::chrono::duration<double, std::micro>(ns).count();
+}
+
+// fire samples one-shot timers back to back, each interval after the
+// previous one fired, and collect how late each one ran
+std::vector<Nanosecond> measure(
+    const EventLoopOptions &options,
+    Nanosecond interval,
+    size_t samples
+)
+{
+    EventLoop loop(options);
+    std::vector<Nanosecond> late;
+    late.reserve(samples);
+    MonoTimestamp deadline;
+
+    std::function<void()> schedule = [&]()
+    {
+        deadline = clock::monoNow() + interval;
+        loop.runAt(
+            deadline,
+            [&]()
+            {
+                late.push_back(clock::monoNow() - deadline);
+                if(late.size() == samples)
+                    loop.quit();
+                else
+                    schedule();
+            }
+        );
+    };
+    schedule();
+    loop.loop();
+    return late;
+}
+
+// highResTimers changes the timer slack of the thread that builds the
+// loop for good, each run gets a thread of its own so it does not leak
+// into the configs measured after it
+std::vector<Nanosecond> run(
+    const EventLoopOptions &options,
+    Nanosecond interval,
+    size_t samples
+)
+{
+    std::vector<Nanosecond> late;
+    std::thread thread([&]()
+    {
+        late = measure(options, interval, samples);
+    });
+    thread.join();
+    return late;
+}
+
+int main()
+{
+    const size_t samples = 500;
+    std::vector<Config> configs(4);
+    configs[0].name = "timerfd";
+    configs[1].name = "poll";
+    configs[1].options.timerSource = TimerSource::kPollTimeout;
+    configs[2].name = "poll+hires";
+    configs[2].options.timerSource = TimerSource::kPollTimeout;
+    configs[2].options.highResTimers = true;
+    configs[3].name = "poll+spin50";
+    configs[3].options.timerSource = TimerSource::kPollTimeout;
+    configs[3].options.highResTimers = true;
+    configs[3].options.timerSpin = 50us;
+
+    printf("%12s %10s %10s %10s %10s\n",
+        "config", "interval", "p50(us)", "p99(us)", "max(us)");
+    for (auto &config: configs)
+    {
+        for (Nanosecond interval: {50us, 100us, 200us, 500us, 1000us})
+        {
+            auto late = run(config.options, interval, samples);
+            std::sort(late.begin(), late.end());
+            printf("%12s %8.0fus %10.1f %10.1f %10.1f\n",
+                config.name, toUs(interval),
+                toUs(late[late.size() / 2]),
+                toUs(late[late.size() * 99 / 100]),
+                toUs(late.back()));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "eloop/eventLoop.hpp"
+#include "eloop/TCPConnection.hpp"
+
+using namespace eloop;
+
+struct Result
+{
+    double cpuMsPerGB;
+    double gbPerSec;
+    uint64_t completed;
+    uint64_t copied;
+};
+
+double threadCpuMs()
+{
+    struct rusage usage;
+    ::getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3 +
+        usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3;
+}
+
+// a connected loopback pair, the sending end non-blocking
+void connectPair(int *sender, int *receiver)
+{
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    ::bind(listener, reinterpret_cast<sockaddr*>(&addr), len);
+    ::listen(listener, 1);
+    ::getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &len);
+    *sender = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    ::connect(*sender, reinterpret_cast<sockaddr*>(&addr), len);
+    *receiver = ::accept(listener, nullptr, nullptr);
+    ::close(listener);
+}
+
+// Send total bytes as chunk-sized Slices through a TCPConnection, with
+// or without setZeroCopy(), while another thread drains the receiver.
+// A run ends once the kernel released every zero-copy page.
+Result run(
+    const EventLoopOptions &options,
+    bool zeroCopy,
+    size_t chunk,
+    size_t total
+)
+{
+    int sender, receiver;
+    connectPair(&sender, &receiver);
+
+    std::thread drain([receiver, total]()
+    {
+        std::vector<char> buf(1 << 20);
+        size_t got = 0;
+        while (got < total)
+        {
+            ssize_t n = ::read(receiver, buf.data(), buf.size());
+            if(n <= 0)
+                break;
+            got += n;
+        }
+    });
+
+    // every send shares the payload, it is never modified
+    Slice payload(std::string(chunk, 'x'));
+    EventLoop loop(options);
+    auto conn = std::make_shared<TCPConnection>(
+        &loop, sender, InetAddress(), InetAddress()
+    );
+    conn->setMessageCallback(
+        [](const TCPConnectionPtr&, Buffer &buffer)
+        {
+            buffer.retrieveAll();
+        }
+    );
+    conn->setCloseCallback(
+        [&loop](const TCPConnectionPtr&)
+        {
+            loop.quit();
+        }
+    );
+    conn->connectEstablished();
+    if(zeroCopy && !conn->setZeroCopy(true, chunk))
+        printf("no SO_ZEROCOPY, measuring copies\n");
+
+    // a few chunks in flight at a time, the next ones once written
+    const size_t kBatch = 8;
+    size_t queued = 0;
+    bool written = false;
+    auto sendBatch = [&](const TCPConnectionPtr &c)
+    {
+        if(queued >= total)
+        {
+            written = true;
+            return;
+        }
+        for (size_t i = 0; i < kBatch && queued < total; i++)
+        {
+            c->send(payload);
+            queued += chunk;
+        }
+    };
+    conn->setWriteCompleteCallback(sendBatch);
+    // the last pages come back after the last write completed
+    loop.runEvery(
+        1ms,
+        [&]()
+        {
+            if(written && payload.useCount() == 1 && conn->connected())
+                conn->forceClose();
+        }
+    );
+
+    double cpu = threadCpuMs();
+    auto start = std::chrono::steady_clock::now();
+    sendBatch(conn);
+    loop.loop();
+    std::chrono::duration<double> wall =
+        std::chrono::steady_clock::now() - start;
+    cpu = threadCpuMs() - cpu;
+
+    Result result;
+    result.completed = conn->zeroCopyCompleted();
+    result.copied = conn->zeroCopyCopied();
+    // the connection closes the sending end once the loop released it
+    conn.reset();
+    drain.join();
+    ::close(receiver);
+
+    double gb = static_cast<double>(total) / 1e9;
+    result.cpuMsPerGB = cpu / gb;
+    result.gbPerSec = gb / wall.count();
+    return result;
+}
+
+int main()
+{
+    const size_t total = 2ULL << 30;
+
+    struct Backend
+    {
+        const char *name;
+        EventLoopOptions options;
+    };
+    std::vector<Backend> backends(2);
+    backends[0].name = "epoll";
+    backends[1].name = "io_uring";
+    backends[1].options.poller = PollerBackend::kIOUring;
+
+    printf("loop CPU per GB sent over loopback, %lu MB per run\n",
+        total >> 20);
+    printf("%10s %10s %10s %12s %10s %12s %10s\n", "backend",
+        "chunk", "mode", "cpu(ms/GB)", "GB/s", "completions", "copied");
+    for (auto &backend: backends)
+    {
+        for (size_t chunk: {64 << 10, 256 << 10, 1 << 20, 4 << 20})
+        {
+            for (bool zeroCopy: {false, true})
+            {
+                Result r = run(backend.options, zeroCopy, chunk, total);
+                printf("%10s %9luK %10s %12.1f %10.2f %12lu %10lu\n",
+                    backend.name, chunk >> 10,
+                    zeroCopy ? "zerocopy": "write",
+                    r.cpuMsPerGB, r.gbPerSec, r.completed, r.copied);
+            }
+        }
+    }
+    printf("\nloopback delivers zero-copy pages by copying them, see "
+        "\"copied\", so zero-copy only adds work here; any saving needs "
+        "a NIC\n");
+    return 0;
+}
@@ -45,7 +45,7 @@ private:
     EventLoop *loop_;
     bool connected_;
     const InetAddress peer_;
-    Timer *retryTimer_;
+    TimerId retryTimer_;
     ConnectorPtr connector_;
     TCPConnectionPtr connection_;
     ConnectionCallback connectionCallback_;
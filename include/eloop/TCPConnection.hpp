@@ -1,9 +1,16 @@
 #pragma once
 
 #include <any>
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <string_view>
+#include <vector>
 #include "eloop/noncopyable.hpp"
 #include "eloop/buffer.hpp"
+#include "eloop/chainBuffer.hpp"
+#include "eloop/slice.hpp"
+#include "eloop/timestamp.hpp"
 #include "eloop/callback.hpp"
 #include "eloop/channel.hpp"
 #include "eloop/inetAddress.hpp"
@@ -14,9 +21,13 @@ namespace eloop
 class EventLoop;
 
 class TCPConnection: noncopyable,
-                     std::enable_shared_from_this<TCPConnection>
+                     public std::enable_shared_from_this<TCPConnection>
 {
 public:
+    static const size_t kDefaultReadBudget = 256 * 1024;
+    static const int kDefaultReadBudgetReads = 16;
+    static const size_t kDefaultZeroCopyThreshold = 64 * 1024;
+
     TCPConnection(
         EventLoop *loop,
         int sockfd,
@@ -30,6 +41,12 @@ public:
         messageCallback_ = cb;
     }
 
+    // used instead of the MessageCallback in chained mode
+    void setChainMessageCallback(const ChainMessageCallback &cb)
+    {
+        chainMessageCallback_ = cb;
+    }
+
     void setWriteCompleteCallback(const WriteCompleteCallback &cb)
     {
         writeCompleteCallback_ = cb;
@@ -91,20 +108,215 @@ public:
         return outputBuffer_;
     }
 
-    // I/O operations are thread safe
+    const ChainBuffer &inputChain() const
+    {
+        return inputChain_;
+    }
+
+    const ChainBuffer &outputChain() const
+    {
+        return outputChain_;
+    }
+
+    // Chained mode, loop thread only and before any data is buffered:
+    // input and output go through ChainBuffers, so large transfers
+    // never move buffered bytes, and output is flushed with writev.
+    void setChainedBuffers(bool on);
+
+    bool chainedBuffers() const
+    {
+        return chained_;
+    }
+
+    // Buffer storage held right now. Buffers are allocated from the
+    // loop's BufferPool on first use and handed back once drained, so
+    // an idle connection holds none.
+    size_t bufferMemory() const
+    {
+        return inputBuffer_.capacity() + outputBuffer_.capacity() +
+            inputChain_.capacity() + outputChain_.capacity();
+    }
+
+    // I/O operations are thread safe. From other threads, everything
+    // sent before the loop gets to it is flushed by one task and one
+    // writev; rvalues and Slices are handed over without a copy.
     void send(std::string_view data);
+    void send(const char *data);
     void send(const char* data, size_t len);
+    void send(std::string &&message);
     void send(Buffer &buff);
+    void send(Buffer &&buff);
+    void send(ChainBuffer &buff);
+    // Queued as is and written straight from the shared storage, the
+    // storage is released once every connection it was sent to has
+    // written it.
+    void send(const Slice &slice);
+    // segments in order, e.g. a header and a body, without joining
+    // them first
+    void send(std::vector<Slice> segments);
+    // Queue length bytes of fd, from offset for a regular file, sent
+    // in order with the rest of the output by sendfile(), or by
+    // splice() when fd is a pipe, which must then provide all of
+    // them. fd is duplicated, the caller may close it right away.
+    void sendFile(int fd, off_t offset, size_t length);
+    // write output held back by auto-cork now
+    void flush();
     void shutdown();
     void forceClose();
 
     void stopRead();
     void startRead();
 
+    // Flow control, loop thread only. Once highWaterMark bytes of
+    // output are queued, reading stops on this connection and on its
+    // backpressure sources, and resumes when the output has drained
+    // to lowWaterMark. A zero highWaterMark turns it off. With
+    // io_uring completions, what the kernel received before the pause
+    // reached it is still delivered.
+    void setBackpressure(size_t highWaterMark, size_t lowWaterMark);
+
+    // Also pause source, which may live on another loop, while this
+    // connection's output is over the high-water mark, e.g. the
+    // upstream feeding a proxy's downstream connection.
+    void addBackpressureSource(const TCPConnectionPtr &source);
+
+    // times reading was paused by flow control, and the total time
+    // spent paused, the current pause included; loop thread only
+    uint64_t readPauses() const
+    {
+        return readPauses_;
+    }
+
+    Nanosecond readPausedTime() const;
+
+    // Edge-triggered mode, loop thread only. handleRead drains the
+    // socket until EAGAIN or the read budget runs out, and handleWrite
+    // writes until EAGAIN.
+    void setEdgeTriggered(bool on);
+
+    // Most a read event may take in before the other connections of
+    // the loop get their turn, loop thread only. A level-triggered
+    // read is capped at bytes and the poller reports the rest again.
+    // In edge-triggered mode at most reads reads, bytes in total, are
+    // done per event and the rest is read in the next loop iteration.
+    // With io_uring completions, once bytes came in during an iteration
+    // the recv is paused. What it still received is held and delivered
+    // at most bytes per iteration, then the recv resumes.
+    void setReadBudget(
+        size_t bytes,
+        int reads = kDefaultReadBudgetReads
+    );
+
+    // read events that used up their budget; loop thread only
+    uint64_t readBudgetExhausted() const
+    {
+        return readBudgetExhausted_;
+    }
+
+    // Zero-copy mode, loop thread only. Output of at least threshold
+    // bytes is sent with MSG_ZEROCOPY: copied output that large is
+    // queued as a Slice, and queued Slices are held until the kernel
+    // reports through the error queue that it is done with their
+    // pages. Returns false when the socket does not support it.
+    // It only saves CPU with a NIC that sends straight from the pages
+    // and sends of a few hundred KB or more. Over loopback the kernel
+    // copies the pages anyway and it costs more than write(), see
+    // examples/zeroCopyBench, so leave it off for local peers.
+    bool setZeroCopy(
+        bool on,
+        size_t threshold = kDefaultZeroCopyThreshold
+    );
+
+    bool zeroCopy() const
+    {
+        return zeroCopy_;
+    }
+
+    // Auto-cork mode, loop thread only. Sends made on the loop thread
+    // only queue their output, which is written once, after the
+    // current loop iteration has dispatched its events, so several
+    // small sends from one callback cost one writev and leave in as
+    // few TCP segments as possible. flush() writes right away.
+    void setAutoCork(bool on);
+
+    bool autoCork() const
+    {
+        return autoCork_;
+    }
+
+    // MSG_ZEROCOPY sends completed, and how many of those the kernel
+    // copied after all (always the case over loopback)
+    uint64_t zeroCopyCompleted() const
+    {
+        return zeroCopyCompleted_;
+    }
+
+    uint64_t zeroCopyCopied() const
+    {
+        return zeroCopyCopied_;
+    }
+
     void connectEstablished();
     bool connected() const;
     bool disconnected() const;
 private:
+    // bytes of a Slice, or a file region when fd is not -1
+    struct OutputSegment
+    {
+        explicit OutputSegment(Slice slice)
+            : data(std::move(slice)),
+              fd(-1),
+              pipe(false),
+              offset(0),
+              fileBytes(0)
+        {}
+
+        OutputSegment(int file, bool isPipe, off_t off, size_t len)
+            : fd(file),
+              pipe(isPipe),
+              offset(off),
+              fileBytes(len)
+        {}
+
+        size_t size() const
+        {
+            return fd == -1 ? data.size(): fileBytes;
+        }
+
+        Slice data;
+        int fd;
+        bool pipe;
+        off_t offset;
+        size_t fileBytes;
+    };
+
+    // output sent from another thread, a segment or a chain
+    struct PendingSend
+    {
+        explicit PendingSend(OutputSegment &&seg)
+            : next(nullptr),
+              segment(std::move(seg))
+        {}
+
+        explicit PendingSend(ChainBuffer &&buffer)
+            : next(nullptr),
+              segment(Slice()),
+              chain(std::move(buffer))
+        {}
+
+        PendingSend *next;
+        OutputSegment segment;
+        ChainBuffer chain;
+    };
+
+    // bytes of a MSG_ZEROCOPY send, until the kernel completes it
+    struct ZeroCopySend
+    {
+        uint32_t id;
+        bool done;
+        Slice data;
+    };
+
     EventLoop *loop_;
     const int sockfd_;
     Channel channel_;
@@ -113,20 +325,118 @@ private:
     InetAddress peer_;
     Buffer inputBuffer_;
     Buffer outputBuffer_;
+    bool chained_;
+    ChainBuffer inputChain_;
+    ChainBuffer outputChain_;
+    // Segments queued after the buffered output, in order, flushed
+    // together with it by writev. Once segments are queued, later
+    // copied output is queued as a segment too.
+    std::deque<OutputSegment> outputQueue_;
+    size_t queuedBytes_;
+    // on the pipe at the front of outputQueue_, reading while it is
+    // empty and writing waits for it instead of for the socket
+    std::unique_ptr<Channel> pipeChannel_;
+    // Lock-free stack of output sent from other threads, newest
+    // first. The send that finds it empty queues the task that
+    // flushes everything pushed until that task runs.
+    std::atomic<PendingSend*> pending_;
     size_t highWaterMark_;
+    size_t backpressureHigh_;
+    size_t backpressureLow_;
+    // output is over backpressureHigh_, reading is paused here and on
+    // the sources
+    bool throttling_;
+    std::vector<std::weak_ptr<TCPConnection>> backpressureSources_;
+    // stopRead() was called
+    bool readStopped_;
+    // flow control pauses in effect, from this or other connections
+    int readPauseCount_;
+    MonoTimestamp readPausedSince_;
+    uint64_t readPauses_;
+    Nanosecond readPausedTime_;
+    bool autoCork_;
+    // a flush is queued for the end of this iteration
+    bool flushQueued_;
+    bool zeroCopy_;
+    size_t zeroCopyThreshold_;
+    // id the kernel gives the next MSG_ZEROCOPY send
+    uint32_t zeroCopyNextId_;
+    std::deque<ZeroCopySend> zeroCopyInFlight_;
+    uint64_t zeroCopyCompleted_;
+    uint64_t zeroCopyCopied_;
+    bool edgeTriggered_;
+    size_t readBudget_;
+    int readBudgetReads_;
+    uint64_t readBudgetExhausted_;
+    // a budget-limited edge-triggered read continues next iteration
+    bool readRequeued_;
+    // bytes received through completions in loop iteration recvIteration_
+    size_t recvTaken_;
+    uint64_t recvIteration_;
+    // input received over budget, not delivered yet
+    ChainBuffer recvHeld_;
     std::any context_;
     MessageCallback messageCallback_;
+    ChainMessageCallback chainMessageCallback_;
     WriteCompleteCallback writeCompleteCallback_;
     HighWaterMarkCallback highWaterMarkCallback_;
     CloseCallback closeCallback_;
 
+    ssize_t readInput(int *savedErrno, size_t maxBytes);
+    void deliverInput();
+    size_t outputBytes() const;
+    void appendOutput(const char *data, size_t len);
+    ssize_t writeOutput();
+    ssize_t writeOutputQueue();
+    ssize_t writeOutputVectors(size_t *wanted);
+    ssize_t writeOutputFile(size_t *wanted);
+    void waitForPipe(int fd);
+    void handlePipeReadable();
+    // output is pending on socket or pipe readiness
+    bool waitingToWrite() const
+    {
+        return channel_.isWriting() || waitingForPipe();
+    }
+    bool waitingForPipe() const
+    {
+        return pipeChannel_ != nullptr && pipeChannel_->isReading();
+    }
+    ssize_t writeOutputZeroCopy(size_t *wanted);
+    bool zeroCopyFront() const;
+    void readZeroCopyCompletions();
+    void completeZeroCopy(uint32_t first, uint32_t last, bool copied);
+    void popOutputSegment();
+    void queueSegment(OutputSegment &&segment);
+    void queueChain(ChainBuffer &chain);
+    void flushQueuedOutput(size_t oldLen);
+    void writeQueuedOutput();
+    void flushInLoop();
+    void updateBackpressure();
+    void throttleSources(bool pause);
+    void pauseReadInLoop();
+    void resumeReadInLoop();
+    void updateReadInterest();
+    void sendPending(OutputSegment &&segment);
+    void pushPending(PendingSend *newest, PendingSend *oldest);
+    void flushPending();
+    static void dropPending(PendingSend *node);
+
     void handleRead();
+    void handleReadEdgeTriggered();
+    void handleRecvCompletion(int res, const char *data);
+    void pauseRecvForBudget();
+    void queueHeldInput();
+    void takeHeldInput(size_t len);
+    void deliverHeldInput();
     void handleWrite();
     void handleClose();
     void handleError();
 
     void sendInLoop(const char *data, size_t len);
-    void sendInLoop(const std::string &message);
+    void sendInLoop(ChainBuffer &chain);
+    void sendInLoop(const Slice &slice);
+    void sendInLoop(std::vector<Slice> &segments);
+    void sendFileInLoop(int fd, bool pipe, off_t offset, size_t length);
     void shutdownInLoop();
     void forceCloseInLoop();
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <netinet/in.h>
 #include "eloop/noncopyable.hpp"
 #include "eloop/inetAddress.hpp"
 #include "eloop/channel.hpp"
@@ -37,6 +38,9 @@ private:
     NewConnectionCallback newConnectionCallback_;
 
     void handleRead();
+    void handleAcceptCompletion(int sockfd);
+    void newConnection(int sockfd, const struct sockaddr_in &addr);
+    void acceptFailed(int savedErrno);
 };
 
 }
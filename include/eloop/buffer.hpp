@@ -1,37 +1,112 @@
 #pragma once
 
 #include <algorithm>
-#include <vector>
+#include <new>
 #include <string>
+#include <string_view>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
+#include "eloop/bufferPool.hpp"
+#include "eloop/byteSearch.hpp"
 
 
 namespace eloop
 {
 
+// Storage is allocated on the first write, from pool if one is set,
+// and can be handed back with release() once the buffer is drained.
 class Buffer
 {
 public:
     static const size_t kCheapPrepend = 8;
     static const size_t kInitialSize = 1024;
-    explicit Buffer(size_t initialSize)
-        : buffer_(initialSize + kCheapPrepend),
+    explicit Buffer(size_t initialSize, BufferPool *pool = nullptr)
+        : data_(nullptr),
+          capacity_(0),
           readerIndex_(kCheapPrepend),
-          writerIndex_(kCheapPrepend)
+          writerIndex_(kCheapPrepend),
+          initialSize_(initialSize),
+          readHint_(0),
+          scanned_(0),
+          pool_(pool),
+          storagePool_(nullptr)
     {
         assert(readableBytes() == 0);
-        assert(writableBytes() == initialSize);
         assert(prependableBytes() == kCheapPrepend);
     }
 
     Buffer(): Buffer(kInitialSize) {}
 
+    Buffer(const Buffer &other): Buffer(other.initialSize_)
+    {
+        append(other.peek(), other.readableBytes());
+    }
+
+    // the storage moves, other keeps its pool for what it allocates next
+    Buffer(Buffer &&other) noexcept: Buffer(other.initialSize_, other.pool_)
+    {
+        swap(other);
+    }
+
+    Buffer &operator=(Buffer other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~Buffer()
+    {
+        deallocate();
+    }
+
+    // storage goes back to the pool it came from, each buffer keeps
+    // its own pool for later allocations
     void swap(Buffer &target)
     {
-        buffer_.swap(target.buffer_);
+        std::swap(data_, target.data_);
+        std::swap(capacity_, target.capacity_);
         std::swap(readerIndex_, target.readerIndex_);
         std::swap(writerIndex_, target.writerIndex_);
+        std::swap(initialSize_, target.initialSize_);
+        std::swap(readHint_, target.readHint_);
+        std::swap(scanned_, target.scanned_);
+        std::swap(storagePool_, target.storagePool_);
+    }
+
+    // empty buffers only, storage allocated later comes from pool
+    void setPool(BufferPool *pool)
+    {
+        assert(data_ == nullptr);
+        pool_ = pool;
+    }
+
+    // For storage that may outlive the pool's loop: it no longer
+    // counts as in use there and is freed to the heap, as is anything
+    // allocated later.
+    void detachPool()
+    {
+        if(storagePool_ != nullptr)
+            storagePool_->detach(capacity_);
+        storagePool_ = nullptr;
+        pool_ = nullptr;
+    }
+
+    // give the storage back if nothing is buffered
+    void release()
+    {
+        if(readableBytes() == 0)
+        {
+            deallocate();
+            retrieveAll();
+            // an idle buffer starts small again
+            readHint_ = 0;
+        }
+    }
+
+    size_t capacity() const
+    {
+        return capacity_;
     }
 
     size_t readableBytes() const
@@ -41,7 +116,7 @@ public:
 
     size_t writableBytes() const
     {
-        return buffer_.size() - writerIndex_;
+        return capacity_ > writerIndex_ ? capacity_ - writerIndex_: 0;
     }
 
     size_t prependableBytes() const
@@ -56,20 +131,88 @@ public:
 
     const char *findCRLF() const
     {
-        const char *crlf = std::search(
-            peek(), beginWrite(), kCRLF, kCRLF + 2
-        );
-        return crlf == beginWrite() ? nullptr: crlf;
+        return find(std::string_view(kCRLF, 2));
     }
 
     const char *findCRLF(const char *start) const
+    {
+        return find(std::string_view(kCRLF, 2), start);
+    }
+
+    // Searches over the readable bytes, from start if given, return
+    // nullptr when nothing matches.
+    const char *find(char c) const
+    {
+        return find(c, peek());
+    }
+
+    const char *find(char c, const char *start) const
     {
         assert(peek() <= start);
         assert(start <= beginWrite());
-        const char *crlf = std::search(
-            start, beginWrite(), kCRLF, kCRLF + 2
-        );
-        return crlf == beginWrite()? nullptr: crlf;
+        return orNull(bytes::find(start, beginWrite(), c));
+    }
+
+    // first byte that is any of set
+    const char *findAnyOf(std::string_view set) const
+    {
+        return findAnyOf(set, peek());
+    }
+
+    const char *findAnyOf(std::string_view set, const char *start) const
+    {
+        assert(peek() <= start);
+        assert(start <= beginWrite());
+        return orNull(bytes::findAnyOf(
+            start, beginWrite(), set.data(), set.size()
+        ));
+    }
+
+    const char *find(std::string_view needle) const
+    {
+        return find(needle, peek());
+    }
+
+    const char *find(std::string_view needle, const char *start) const
+    {
+        assert(peek() <= start);
+        assert(start <= beginWrite());
+        return orNull(bytes::find(
+            start, beginWrite(), needle.data(), needle.size()
+        ));
+    }
+
+    // Resumable searches for parsers waiting on a delimiter: bytes
+    // searched without a match are not searched again by the next
+    // scan, until a match or retrieve() moves past them. Use one
+    // delimiter at a time, or resetScan() when switching.
+    const char *scan(char c)
+    {
+        const char *hit = find(c, peek() + scanned_);
+        scanned_ = hit == nullptr ? readableBytes(): 0;
+        return hit;
+    }
+
+    const char *scan(std::string_view delimiter)
+    {
+        // a delimiter may straddle the end of the previous scan
+        size_t overlap = delimiter.empty() ? 0: delimiter.size() - 1;
+        size_t from = scanned_ > overlap ? scanned_ - overlap: 0;
+        const char *hit = find(delimiter, peek() + from);
+        scanned_ = hit == nullptr ? readableBytes(): 0;
+        return hit;
+    }
+
+    const char *scanAnyOf(std::string_view set)
+    {
+        const char *hit = findAnyOf(set, peek() + scanned_);
+        scanned_ = hit == nullptr ? readableBytes(): 0;
+        return hit;
+    }
+
+    void resetScan()
+    {
+        scanned_ = 0;
     }
 
     const char *findEOL() const
@@ -91,15 +234,21 @@ public:
         // abandon all buffer
         readerIndex_ = kCheapPrepend;
         writerIndex_ = kCheapPrepend;
+        scanned_ = 0;
     }
 
     void retrieve(size_t len)
     {
         assert(len <= readableBytes());
         if(len < readableBytes())
+        {
             readerIndex_ += len;
+            scanned_ = scanned_ > len ? scanned_ - len: 0;
+        }
         else
+        {
             retrieveAll();
+        }
     }
 
     void retrieveUntil(const char *end)
@@ -131,7 +280,7 @@ public:
 
     std::string retrieveAsString(size_t len)
     {
-        assert(len < readableBytes());
+        assert(len <= readableBytes());
         std::string result(peek(), len);
         retrieve(len);
         return result;
@@ -153,7 +302,7 @@ public:
 
     void hasWritten(size_t len)
     {
-        assert(len < writableBytes());
+        assert(len <= writableBytes());
         writerIndex_ += len;
     }
 
@@ -277,11 +426,25 @@ public:
     }
 
     ssize_t readFD(int fd, int *savedErrno);
+    // Overflow goes to spill and is appended from there. Bursts
+    // larger than the free space grow the buffer before the next
+    // read, so they land in place with a single copy. At most maxBytes
+    // are read.
+    ssize_t readFD(
+        int fd,
+        int *savedErrno,
+        char *spill,
+        size_t spillSize,
+        size_t maxBytes = SIZE_MAX
+    );
 
     void prepend(const void *data, size_t len)
     {
         assert(len <= prependableBytes());
+        if(data_ == nullptr)
+            reserve(initialSize_ + kCheapPrepend);
         readerIndex_ -= len;
+        scanned_ = 0;
         auto d = static_cast<const char*>(data);
         std::copy(
             d,
@@ -290,26 +453,87 @@ public:
         );
     }
 private:
-    std::vector<char> buffer_;
+    char *data_;
+    size_t capacity_;
     size_t readerIndex_;
     size_t writerIndex_;
+    size_t initialSize_;
+    // recent read size, rises at once and decays slowly
+    size_t readHint_;
+    // readable bytes already searched by scan()
+    size_t scanned_;
+    // where storage comes from, and where data_ came from
+    BufferPool *pool_;
+    BufferPool *storagePool_;
     static const char kCRLF[];
+    // what an unallocated buffer points into
+    static char kEmpty[kCheapPrepend];
+
+    const char *orNull(const char *hit) const
+    {
+        return hit == beginWrite() ? nullptr: hit;
+    }
 
     char *begin()
     {
-        return &*buffer_.begin();
+        return data_ != nullptr ? data_: kEmpty;
     }
 
     const char *begin() const
     {
-        return &*buffer_.begin();
+        return data_ != nullptr ? data_: kEmpty;
+    }
+
+    // move to storage of at least capacity bytes, readable bytes
+    // go to the front
+    void reserve(size_t capacity)
+    {
+        size_t readable = readableBytes();
+        assert(capacity >= kCheapPrepend + readable);
+        char *data;
+        if(pool_ != nullptr)
+            data = pool_->allocate(capacity);
+        else
+            data = static_cast<char*>(::operator new(capacity));
+        // an unallocated buffer has nothing to move
+        if(data_ != nullptr && readable > 0)
+            std::copy(
+                data_ + readerIndex_,
+                data_ + writerIndex_,
+                data + kCheapPrepend
+            );
+        deallocate();
+        data_ = data;
+        capacity_ = capacity;
+        storagePool_ = pool_;
+        readerIndex_ = kCheapPrepend;
+        writerIndex_ = readerIndex_ + readable;
+    }
+
+    void deallocate()
+    {
+        if(data_ == nullptr)
+            return;
+        if(storagePool_ != nullptr)
+            storagePool_->deallocate(data_, capacity_);
+        else
+            ::operator delete(data_);
+        data_ = nullptr;
+        storagePool_ = nullptr;
+        capacity_ = 0;
     }
 
     void makeSpace(size_t len)
     {
         if (writableBytes() + prependableBytes() < len + kCheapPrepend)
         {
-            buffer_.resize(writerIndex_ + len);
+            // grow geometrically, from initialSize_ when unallocated
+            size_t needed = writerIndex_ - readerIndex_ + kCheapPrepend + len;
+            size_t capacity = std::max(
+                needed,
+                data_ == nullptr ? initialSize_ + kCheapPrepend: 2 * capacity_
+            );
+            reserve(capacity);
         }
         else
         {
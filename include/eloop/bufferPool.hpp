@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+#include "eloop/noncopyable.hpp"
+
+
+namespace eloop
+{
+
+// Size-classed cache of buffer storage, one per EventLoop. Requests
+// are rounded up to a power of two between kMinClass and kMaxClass,
+// larger ones go straight to the heap. Each class keeps at most
+// maxCachedBytes / kNumClasses of released storage. Storage must come
+// back to the pool that handed it out. All of it comes from operator
+// new, so storage leaving the loop can be detached and freed to the
+// heap instead.
+class BufferPool: noncopyable
+{
+public:
+    static const size_t kMinClass = 1024;
+    static const size_t kMaxClass = 64 * 1024;
+    static const int kNumClasses = 7;
+
+    explicit BufferPool(size_t maxCachedBytes = 8 * 1024 * 1024);
+    ~BufferPool();
+
+    // thread safe, capacity is rounded up to what was handed out
+    char *allocate(size_t &capacity);
+    void deallocate(char *data, size_t capacity);
+    // storage handed out that goes to the heap instead of coming back
+    void detach(size_t capacity);
+
+    // storage handed out and not returned yet
+    size_t bytesInUse() const;
+    // storage kept for reuse
+    size_t bytesCached() const;
+private:
+    const size_t maxCachedPerClass_;
+    mutable std::mutex mutex_;
+    std::vector<char*> free_[kNumClasses];
+    size_t bytesInUse_;
+    size_t bytesCached_;
+
+    static int classOf(size_t capacity);
+};
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+
+
+namespace eloop
+{
+
+// Byte searches over [begin, end), returning end when nothing matches.
+// SSE2/AVX2 versions are picked at runtime, with a scalar fallback on
+// other targets.
+namespace bytes
+{
+
+const char *find(const char *begin, const char *end, char c);
+
+// first byte that is one of set[0, setSize)
+const char *findAnyOf(
+    const char *begin, const char *end,
+    const char *set, size_t setSize
+);
+
+// first occurrence of needle[0, needleSize)
+const char *find(
+    const char *begin, const char *end,
+    const char *needle, size_t needleSize
+);
+
+// "avx2", "sse2" or "scalar"
+const char *implementation();
+
+}
+
+}
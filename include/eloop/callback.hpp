@@ -2,11 +2,13 @@
 
 #include <memory>
 #include <functional>
+#include "eloop/inlineFunction.hpp"
 
 namespace eloop
 {
 
 class Buffer;
+class ChainBuffer;
 class TCPConnection;
 class InetAddress;
 
@@ -16,6 +18,8 @@ using ConnectionCallback = std::function<void(const TCPConnectionPtr&)>;
 using WriteCompleteCallback = std::function<void(const TCPConnectionPtr&)>;
 using HighWaterMarkCallback = std::function<void(const TCPConnectionPtr, size_t)>;
 using MessageCallback = std::function<void(const TCPConnectionPtr&, Buffer&)>;
+using ChainMessageCallback =
+    std::function<void(const TCPConnectionPtr&, ChainBuffer&)>;
 
 using ErrorCallback = std::function<void()>;
 using NewConnectionCallback = std::function<
@@ -25,12 +29,16 @@ using NewConnectionCallback = std::function<
             const InetAddress &peer
         )
     >;
-using Task = std::function<void()>;
+using Task = InlineFunction<void()>;
 using ThreadInitCallback = std::function<void(size_t index)>;
-using TimerCallback = std::function<void()>;
+using TimerCallback = InlineFunction<void()>;
 
 void defaultThreadInitCallback(size_t index);
 void defaultConnectionCallback(const TCPConnectionPtr &conn);
 void defaultMessageCallback(const TCPConnectionPtr &conn, Buffer &buffer);
+void defaultChainMessageCallback(
+    const TCPConnectionPtr &conn,
+    ChainBuffer &buffer
+);
 
 }
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "eloop/bufferPool.hpp"
+#include "eloop/noncopyable.hpp"
+
+
+namespace eloop
+{
+
+// Buffer made of a chain of fixed-size blocks. Appending fills the
+// last block and links a new one when it is full, so existing bytes
+// are never moved or copied again; retrieving frees drained blocks.
+// Readable bytes are only contiguous within a block, walk them with
+// forEachSegment()/peekSegments() or make a prefix contiguous with
+// pullup().
+class ChainBuffer: noncopyable
+{
+public:
+    // allocation size of a block, header included
+    static constexpr size_t kBlockSize = 16 * 1024;
+
+    explicit ChainBuffer(BufferPool *pool = nullptr);
+    ChainBuffer(ChainBuffer &&other) noexcept;
+    ChainBuffer &operator=(ChainBuffer &&other) noexcept;
+    ~ChainBuffer();
+
+    // blocks go back to the pool they came from, each buffer keeps
+    // its own pool for later blocks
+    void swap(ChainBuffer &target);
+
+    // empty buffers only, blocks allocated later come from pool
+    void setPool(BufferPool *pool)
+    {
+        assert(head_ == nullptr && spare_ == nullptr);
+        pool_ = pool;
+    }
+
+    // For blocks that may outlive the pool's loop: they no longer
+    // count as in use there and are freed to the heap, as is anything
+    // allocated later.
+    void detachPool();
+
+    // free every block if nothing is buffered
+    void release();
+
+    // bytes of blocks held, buffered or not
+    size_t capacity() const;
+
+    size_t readableBytes() const
+    {
+        return readable_;
+    }
+
+    // first contiguous segment
+    const char *peek() const
+    {
+        return head_ == nullptr ? nullptr: head_->data() + head_->read;
+    }
+
+    size_t contiguousBytes() const
+    {
+        return head_ == nullptr ? 0: head_->write - head_->read;
+    }
+
+    // f(const char *data, size_t len) for every segment, in order
+    template<typename F>
+    void forEachSegment(F &&f) const
+    {
+        for (Block *block = head_; block != nullptr; block = block->next)
+        {
+            if(block->write > block->read)
+                f(block->data() + block->read, block->write - block->read);
+        }
+    }
+
+    // fill at most maxIov entries with the leading segments, returns
+    // the number filled
+    int peekSegments(struct iovec *iov, int maxIov) const;
+
+    // make the first len readable bytes contiguous, returns peek()
+    const char *pullup(size_t len);
+
+    void retrieve(size_t len);
+    void retrieveAll();
+
+    std::string retrieveAsString(size_t len);
+
+    std::string retrieveAllAsString()
+    {
+        return retrieveAsString(readableBytes());
+    }
+
+    void append(const char *data, size_t len);
+
+    void append(const void *data, size_t len)
+    {
+        append(static_cast<const char*>(data), len);
+    }
+
+    void append(std::string_view data)
+    {
+        append(data.data(), data.size());
+    }
+
+    void append(const std::string &data)
+    {
+        append(data.data(), data.size());
+    }
+
+    // link other's blocks after ours, nothing is copied
+    void append(ChainBuffer &&other);
+
+    ssize_t readFD(int fd, int *savedErrno);
+    // Overflow goes to spill and is appended from there. Recent read
+    // sizes decide how many fresh blocks the read offers, so bursts
+    // land in blocks directly. At most maxBytes are read.
+    ssize_t readFD(
+        int fd,
+        int *savedErrno,
+        char *spill,
+        size_t spillSize,
+        size_t maxBytes = SIZE_MAX
+    );
+private:
+    struct Block
+    {
+        Block *next;
+        // where the block came from, nullptr for the heap
+        BufferPool *pool;
+        uint32_t capacity;
+        uint32_t read;
+        uint32_t write;
+
+        // bytes follow the header
+        char *data()
+        {
+            return reinterpret_cast<char*>(this + 1);
+        }
+    };
+
+    static constexpr size_t kBlockCapacity = kBlockSize - sizeof(Block);
+    // fresh blocks a single read may fill
+    static const int kMaxReadBlocks = 16;
+
+    Block *head_;
+    Block *tail_;
+    size_t readable_;
+    // one drained block kept for the next append
+    Block *spare_;
+    // recent read size, rises at once and decays slowly
+    size_t readHint_;
+    BufferPool *pool_;
+
+    Block *newBlock(size_t capacity);
+    void deleteBlock(Block *block);
+
+    Block *takeBlock();
+    void recycle(Block *block);
+    void link(Block *block);
+
+    size_t tailWritable() const
+    {
+        return tail_ == nullptr ? 0: tail_->capacity - tail_->write;
+    }
+};
+
+}
@@ -2,6 +2,7 @@
 
 #include <functional>
 #include <memory>
+#include <vector>
 #include <sys/epoll.h>
 #include "eloop/noncopyable.hpp"
 
@@ -18,8 +19,24 @@ public:
     using WriteCallback = std::function<void()>;
     using CloseCallback = std::function<void()>;
     using ErrorCallback = std::function<void()>;
+    // res is what recv or accept4 would have returned, -errno on
+    // failure; data, for a recv, is only valid during the call
+    using CompletionCallback = std::function<void(int res, const char *data)>;
 
+    enum class CompletionOp
+    {
+        kNone,
+        kRecv,
+        kAccept
+    };
+
+    // poller bookkeeping: registered in kernel, with which events,
+    // and whether an interest change is waiting to be flushed
     bool polling;
+    unsigned pollingEvents;
+    bool dirty;
+    // in the poller's active list already
+    bool reported;
 
     Channel(EventLoop *loop, int fd);
     ~Channel();
@@ -44,6 +61,27 @@ public:
         errorCallback_ = cb;
     }
 
+    // Completion mode, used when the loop's poller supports it. While
+    // reading is enabled the poller receives from, or accepts on, the
+    // fd itself and hands every result to cb instead of reporting
+    // EPOLLIN. Set before reading is enabled.
+    void setCompletion(CompletionOp op, const CompletionCallback &cb)
+    {
+        completionOp_ = op;
+        completionCallback_ = cb;
+    }
+
+    CompletionOp completionOp() const
+    {
+        return completionOp_;
+    }
+
+    // poller side
+    void addCompletion(int res, const char *data)
+    {
+        completions_.push_back({res, data});
+    }
+
     int fd() const 
     {
         return fd_;
@@ -56,7 +94,20 @@ public:
 
     unsigned events() const
     {
-        return events_;
+        return edgeTriggered_ ? (events_ | EPOLLET): events_;
+    }
+
+    // register with EPOLLET, handlers must drain until EAGAIN
+    void setEdgeTriggered(bool on)
+    {
+        edgeTriggered_ = on;
+        if(!isNoneEvents())
+            update();
+    }
+
+    bool edgeTriggered() const
+    {
+        return edgeTriggered_;
     }
 
     void setRevents(unsigned revents)
@@ -64,6 +115,11 @@ public:
         revents_ = revents;
     }
 
+    unsigned revents() const
+    {
+        return revents_;
+    }
+
     void enableRead()
     {
         events_ |= (EPOLLIN | EPOLLPRI);
@@ -88,25 +144,50 @@ public:
         update();
     }
 
+    // Report EPOLLERR even with nothing else to wait for, as with the
+    // error queue of a socket that only writes.
+    void enableError()
+    {
+        events_ |= EPOLLERR;
+        update();
+    }
+
+    void disableError()
+    {
+        events_ &= ~EPOLLERR;
+        update();
+    }
+
     void disableAll()
     {
         events_ = 0;
         update();
     }
 
-    bool isReading()
+    bool isReading() const
     {
         return events_ & EPOLLIN;
     }
 
-    bool isWriting()
+    bool isWriting() const
     {
         return events_ & EPOLLOUT;
     }
 
+    bool isErrorEnabled() const
+    {
+        return events_ & EPOLLERR;
+    }
+
     void handleEvents();
     void tie(const std::shared_ptr<void>& obj);
 private:
+    struct Completion
+    {
+        int res;
+        const char *data;
+    };
+
     void update();
     void remove();
 
@@ -120,6 +201,7 @@ private:
 
     unsigned events_;
     unsigned revents_;
+    bool edgeTriggered_;
 
     bool handlingEvents_;
 
@@ -127,6 +209,11 @@ private:
     WriteCallback writeCallback_;
     CloseCallback closeCallback_;
     ErrorCallback errorCallback_;
+
+    CompletionOp completionOp_;
+    CompletionCallback completionCallback_;
+    std::vector<Completion> completions_;
+    std::vector<Completion> handlingCompletions_;
 };
 
 }
@@ -2,29 +2,43 @@
 
 #include <vector>
 #include <sys/epoll.h>
-#include "eloop/noncopyable.hpp"
+#include "eloop/poller.hpp"
 
 namespace eloop
 {
 
-class Channel;
-class EventLoop;
-
-class EPoller: noncopyable
+// Interest changes are recorded on the Channel and flushed once right
+// before epoll_wait, so changes cancelling each other within one loop
+// iteration cost no epoll_ctl. Removal is applied at once since the fd
+// may be closed right after.
+class EPoller: public Poller
 {
 public:
-    using ChannelList = std::vector<Channel*>;
-
     explicit EPoller(EventLoop *loop);
-    ~EPoller();
+    ~EPoller() override;
+
+    void poll(
+        ChannelList &activeChannels,
+        Nanosecond timeout = Nanosecond(-1)
+    ) override;
+    void updateChannel(Channel *channel) override;
 
-    void poll(ChannelList &activeChannels);
-    void updateChannel(Channel *channel);
+    uint64_t elidedUpdates() const override
+    {
+        return numUpdates_ - numEpollCtl_;
+    }
 private:
     void updateChannel(int op, Channel *channel);
+    void flushUpdates();
+    int wait(Nanosecond timeout);
     EventLoop* loop_;
     std::vector<struct epoll_event> events_;
     int epollfd_;
+    ChannelList dirtyChannels_;
+    uint64_t numUpdates_;
+    uint64_t numEpollCtl_;
+    // epoll_pwait2 (5.11) takes a nanosecond timeout
+    bool pwait2_;
 };
 
 }
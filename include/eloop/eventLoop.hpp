@@ -1,38 +1,179 @@
 #pragma once
 
 #include <atomic>
-#include <mutex>
+#include <chrono>
+#include <memory>
 #include <vector>
 #include <sys/types.h>
 #include "eloop/timer.hpp"
-#include "eloop/epoller.hpp"
+#include "eloop/poller.hpp"
+#include "eloop/bufferPool.hpp"
+#include "eloop/mpscQueue.hpp"
 #include "eloop/timerQueue.hpp"
 
 
 namespace eloop
 {
 
+struct EventLoopOptions
+{
+    PollerBackend poller = PollerBackend::kEPoll;
+    // with io_uring, connections receive and listeners accept through
+    // multishot completions instead of readiness and a syscall each
+    bool ioUringCompletions = true;
+    TimerBackend timers = TimerBackend::kOrderedSet;
+    // TimingWheel granularity
+    Nanosecond timerTick = 1ms;
+    TimerSource timerSource = TimerSource::kTimerfd;
+    // sample now() from CLOCK_MONOTONIC_COARSE, see EventLoop::now()
+    bool coarseClock = false;
+    // set the loop thread's kernel timer slack to 1ns, the loop
+    // must be constructed in the thread that runs it
+    bool highResTimers = false;
+    // poll without sleeping once the next timer is this close, trades
+    // CPU for firing accuracy on sub-millisecond timers
+    Nanosecond timerSpin = Nanosecond::zero();
+};
+
 class EventLoop: noncopyable
 {
 public:
     EventLoop();
+    explicit EventLoop(PollerBackend backend);
+    explicit EventLoop(const EventLoopOptions &options);
     ~EventLoop();
 
     void loop();
     void quit();
 
-    void runInLoop(const Task &task);
     void runInLoop(Task &&task);
-    void queueInLoop(const Task &task);
     void queueInLoop(Task &&task);
+    // Run task once this iteration has dispatched its events, timers
+    // and pending tasks, before polling again. Lets work triggered
+    // several times per iteration, like flushing a connection, be
+    // done once. Loop thread only.
+    void queueAtIterationEnd(Task &&task);
+    // Run task in the next iteration, after the events that poll
+    // returns, which does not block while tasks wait. Lets a busy
+    // source yield to the others for a round. Loop thread only.
+    void queueNextIteration(Task &&task);
+
+    // Monotonic time sampled once per loop iteration, right after
+    // polling returns. Reading it costs nothing, but it does not
+    // advance while callbacks run. With coarseClock, iterations that
+    // did not sleep sample CLOCK_MONOTONIC_COARSE. Loop thread only.
+    MonoTimestamp now() const
+    {
+        return now_;
+    }
+
+    // Number of the current loop iteration, loop thread only.
+    uint64_t iteration() const
+    {
+        return iteration_;
+    }
 
-    Timer *runAt(Timestamp when, TimerCallback callback);
-    Timer *runAfter(Nanosecond interval, TimerCallback callback);
-    Timer *runEvery(Nanosecond interval, TimerCallback callback);
-    void cancelTimer(Timer *timer);
+    // A non-zero slack allows the timer to fire up to slack late, so
+    // timers with close deadlines are run from a single wakeup.
+    TimerId runAt(
+        MonoTimestamp when,
+        TimerCallback callback,
+        Nanosecond slack = Nanosecond::zero()
+    );
+    // wall clock deadline, converted to monotonic time on the call
+    TimerId runAt(
+        Timestamp when,
+        TimerCallback callback,
+        Nanosecond slack = Nanosecond::zero()
+    );
+    TimerId runAfter(
+        Nanosecond interval,
+        TimerCallback callback,
+        Nanosecond slack = Nanosecond::zero()
+    );
+    TimerId runEvery(
+        Nanosecond interval,
+        TimerCallback callback,
+        Nanosecond slack = Nanosecond::zero()
+    );
+    // no-op if the timer already fired or was canceled
+    void cancelTimer(TimerId id);
 
     void wakeup();
 
+    // eventfd writes done vs. skipped because one was pending
+    uint64_t wakeupsIssued() const
+    {
+        return wakeupsIssued_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t wakeupsSuppressed() const
+    {
+        return wakeupsSuppressed_.load(std::memory_order_relaxed);
+    }
+
+    // Busy-poll mode: after the last activity keep polling epoll with
+    // a zero timeout for up to budget before blocking again. A zero
+    // budget (the default) disables it. socketBusyPollUs > 0 also sets
+    // SO_BUSY_POLL on connections established on this loop.
+    void setBusyPoll(Microsecond budget, int socketBusyPollUs = 0);
+
+    int socketBusyPollUs() const
+    {
+        return socketBusyPollUs_;
+    }
+
+    // zero-timeout polls issued while spinning
+    uint64_t busyPollSpins() const
+    {
+        return busyPollSpins_.load(std::memory_order_relaxed);
+    }
+
+    // blocking polls that returned work and restarted spinning
+    uint64_t busyPollTransitions() const
+    {
+        return busyPollTransitions_.load(std::memory_order_relaxed);
+    }
+
+    // zero-timeout polls issued waiting for a timer, see timerSpin
+    uint64_t timerSpins() const
+    {
+        return timerSpins_.load(std::memory_order_relaxed);
+    }
+
+    // timer wakeups avoided because several timers were due at once,
+    // loop thread only
+    uint64_t timerWakeupsSaved() const
+    {
+        return timerQueue_.timersFired() - timerQueue_.timerWakeups();
+    }
+
+    uint64_t elidedPollerUpdates() const
+    {
+        return poller_->elidedUpdates();
+    }
+
+    // the poller reads and accepts for channels in completion mode
+    bool completionIO() const
+    {
+        return poller_->completionIO();
+    }
+
+    // Scratch space Buffer::readFD spills into, shared by every
+    // connection of the loop. Loop thread only.
+    static const size_t kSpillBufferSize = 64 * 1024;
+
+    char *spillBuffer()
+    {
+        return spillBuffer_.get();
+    }
+
+    // storage for the Buffers of this loop's connections
+    BufferPool &bufferPool()
+    {
+        return bufferPool_;
+    }
+
     void updateChannel(Channel *channel);
     void removeChannel(Channel *Channel);
 
@@ -43,15 +184,43 @@ private:
     const pid_t tid_;
     std::atomic_bool quit_;
     bool doingPendingTasks_;
-    EPoller poller_;
-    EPoller::ChannelList activeChannels_;
+    std::unique_ptr<Poller> poller_;
+    Poller::ChannelList activeChannels_;
     const int wakeupFd_;
     Channel wakeupChannel_;
-    std::mutex mutex_;
-    std::vector<Task> pendingTasks_;
+    std::atomic_bool wakeupPending_;
+    std::atomic<uint64_t> wakeupsIssued_;
+    std::atomic<uint64_t> wakeupsSuppressed_;
+    MPSCQueue<Task> pendingTasks_;
+    std::vector<Task> iterationEndTasks_;
+    std::vector<Task> runningIterationEndTasks_;
+    std::vector<Task> nextIterationTasks_;
+    std::vector<Task> runningNextIterationTasks_;
+    std::unique_ptr<char[]> spillBuffer_;
+    BufferPool bufferPool_;
+    const bool coarseClock_;
+    const Nanosecond timerSpin_;
+    bool timerSpinning_;
+    std::atomic<uint64_t> timerSpins_;
+    Nanosecond coarseResolution_;
+    MonoTimestamp now_;
+    uint64_t iteration_;
+    // how far now_ may trail the precise clock
+    Nanosecond nowLag_;
     TimerQueue timerQueue_;
+    Nanosecond busyPollBudget_;
+    int socketBusyPollUs_;
+    MonoTimestamp lastActive_;
+    std::atomic<uint64_t> busyPollSpins_;
+    std::atomic<uint64_t> busyPollTransitions_;
 
-    void doPendingTasks();
+    void updateNow(bool coarse);
+    // now_ in the loop thread, a fresh sample elsewhere
+    MonoTimestamp scheduleNow();
+    Nanosecond pollTimeout();
+    size_t doPendingTasks();
+    void doIterationEndTasks();
+    size_t doNextIterationTasks();
     void handleRead();
 };
 
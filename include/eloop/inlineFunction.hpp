@@ -0,0 +1,203 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+
+namespace eloop
+{
+
+// Big enough for a shared_ptr plus a std::string or a std::function,
+// which covers the captures eloop itself queues; sizeof is one cache line.
+static const size_t kInlineFunctionSize = 56;
+
+template<typename Signature, size_t Capacity = kInlineFunctionSize>
+class InlineFunction;
+
+// Move-only std::function replacement that keeps the callable in a
+// fixed inline buffer. Callables that do not fit fall back to the heap,
+// unless ELOOP_STRICT_INLINE_FUNCTION is defined, in which case they
+// are rejected at compile time.
+template<typename R, typename... Args, size_t Capacity>
+class InlineFunction<R(Args...), Capacity>
+{
+public:
+    template<typename F>
+    static constexpr bool fitsInline()
+    {
+        return sizeof(F) <= Capacity &&
+            alignof(F) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible<F>::value;
+    }
+
+    InlineFunction() noexcept: ops_(nullptr) {}
+    InlineFunction(std::nullptr_t) noexcept: ops_(nullptr) {}
+
+    template<
+        typename F,
+        typename D = typename std::decay<F>::type,
+        typename = typename std::enable_if<
+            !std::is_same<D, InlineFunction>::value &&
+            std::is_invocable_r<R, D&, Args...>::value
+        >::type
+    >
+    InlineFunction(F &&f): ops_(nullptr)
+    {
+#ifdef ELOOP_STRICT_INLINE_FUNCTION
+        static_assert(
+            fitsInline<D>(),
+            "callable does not fit in InlineFunction, it would be "
+            "heap allocated"
+        );
+#endif
+        if (isNull(f))
+            return;
+        if constexpr (fitsInline<D>())
+        {
+            new (storage_) D(std::forward<F>(f));
+            ops_ = &kInlineOps<D>;
+        }
+        else
+        {
+            *reinterpret_cast<D**>(storage_) = new D(std::forward<F>(f));
+            ops_ = &kHeapOps<D>;
+        }
+    }
+
+    InlineFunction(InlineFunction &&other) noexcept: ops_(other.ops_)
+    {
+        if (ops_ != nullptr)
+        {
+            ops_->move(storage_, other.storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    InlineFunction &operator=(InlineFunction &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            if (other.ops_ != nullptr)
+            {
+                ops_ = other.ops_;
+                ops_->move(storage_, other.storage_);
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    InlineFunction &operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    ~InlineFunction()
+    {
+        reset();
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return ops_ != nullptr;
+    }
+
+    R operator()(Args... args)
+    {
+        return ops_->invoke(storage_, std::forward<Args>(args)...);
+    }
+private:
+    struct Ops
+    {
+        R (*invoke)(void *storage, Args&&... args);
+        // move-construct into dst and destroy src
+        void (*move)(void *dst, void *src) noexcept;
+        void (*destroy)(void *storage) noexcept;
+    };
+
+    template<typename D>
+    static R invokeInline(void *storage, Args&&... args)
+    {
+        return std::invoke(
+            *static_cast<D*>(storage), std::forward<Args>(args)...
+        );
+    }
+
+    template<typename D>
+    static void moveInline(void *dst, void *src) noexcept
+    {
+        D *from = static_cast<D*>(src);
+        new (dst) D(std::move(*from));
+        from->~D();
+    }
+
+    template<typename D>
+    static void destroyInline(void *storage) noexcept
+    {
+        static_cast<D*>(storage)->~D();
+    }
+
+    template<typename D>
+    static R invokeHeap(void *storage, Args&&... args)
+    {
+        return std::invoke(
+            **static_cast<D**>(storage), std::forward<Args>(args)...
+        );
+    }
+
+    static void moveHeap(void *dst, void *src) noexcept
+    {
+        *static_cast<void**>(dst) = *static_cast<void**>(src);
+    }
+
+    template<typename D>
+    static void destroyHeap(void *storage) noexcept
+    {
+        delete *static_cast<D**>(storage);
+    }
+
+    template<typename D>
+    static constexpr Ops kInlineOps = {
+        &invokeInline<D>, &moveInline<D>, &destroyInline<D>
+    };
+
+    template<typename D>
+    static constexpr Ops kHeapOps = {
+        &invokeHeap<D>, &moveHeap, &destroyHeap<D>
+    };
+
+    template<typename F>
+    static bool isNull(const F &f)
+    {
+        if constexpr (std::is_pointer<F>::value ||
+                      std::is_member_pointer<F>::value)
+            return f == nullptr;
+        else
+            return false;
+    }
+
+    template<typename Sig>
+    static bool isNull(const std::function<Sig> &f)
+    {
+        return !f;
+    }
+
+    void reset() noexcept
+    {
+        if (ops_ != nullptr)
+        {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[Capacity];
+    const Ops *ops_;
+};
+
+}
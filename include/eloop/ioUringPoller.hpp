@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <linux/io_uring.h>
+#include "eloop/channel.hpp"
+#include "eloop/poller.hpp"
+
+namespace eloop
+{
+
+// Backend on top of io_uring. Every interest change is a one-shot
+// IORING_OP_POLL_ADD/POLL_REMOVE queued in the submission ring, and
+// all of them go to the kernel together with the wait in a single
+// io_uring_enter per loop iteration, instead of one epoll_ctl each.
+// Fired channels are re-armed on the next poll, which keeps the
+// level-triggered semantics Channel users rely on.
+//
+// Channels in completion mode are not polled for reading. A multishot
+// recv fills buffers of a ring shared by the loop, or a multishot
+// accept hands out new fds, so incoming data and connections cost no
+// syscall of their own.
+class IOUringPoller: public Poller
+{
+public:
+    IOUringPoller(EventLoop *loop, bool completions);
+    ~IOUringPoller() override;
+
+    // kernel has io_uring with the features we need
+    static bool supported();
+
+    void poll(
+        ChannelList &activeChannels,
+        Nanosecond timeout = Nanosecond(-1)
+    ) override;
+    void updateChannel(Channel *channel) override;
+    void removeChannel(Channel *channel) override;
+
+    bool completionIO() const override
+    {
+        return bufferRing_ != nullptr;
+    }
+private:
+    struct Registration
+    {
+        // readiness poll
+        uint64_t token;
+        bool armed;
+        // multishot recv or accept
+        uint64_t opToken;
+        bool opArmed;
+        // multishots that may still complete, canceled ones included
+        std::vector<uint64_t> opTokens;
+    };
+
+    struct Request
+    {
+        // nullptr once removed
+        Channel *channel;
+        // kNone for a readiness poll
+        Channel::CompletionOp op;
+    };
+
+    // user_data of requests whose completion we ignore
+    static const uint64_t kIgnoreToken = 0;
+    static const unsigned kRecvBuffers = 256;
+    static const unsigned kRecvBufferSize = 16 * 1024;
+    static const uint16_t kRecvBufferGroup = 0;
+
+    EventLoop *loop_;
+    int ringfd_;
+    unsigned sqEntries_;
+    void *sqRing_;
+    size_t sqRingSize_;
+    void *cqRing_;
+    size_t cqRingSize_;
+    struct io_uring_sqe *sqes_;
+    unsigned *sqHead_;
+    unsigned *sqTail_;
+    unsigned *sqMask_;
+    unsigned *sqArray_;
+    unsigned *cqHead_;
+    unsigned *cqTail_;
+    unsigned *cqMask_;
+    struct io_uring_cqe *cqes_;
+    unsigned toSubmit_;
+
+    // provided buffers for multishot recv, nullptr without completions.
+    // Not struct io_uring_buf_ring, in C++ its bufs member does not
+    // start at offset 0.
+    struct io_uring_buf *bufferRing_;
+    char *recvBuffers_;
+    uint16_t bufferTail_;
+    // handed to channels in the last poll, given back in this one
+    std::vector<uint16_t> usedBuffers_;
+
+    uint64_t nextToken_;
+    std::unordered_map<Channel*, Registration> registrations_;
+    std::unordered_map<uint64_t, Request> tokens_;
+    ChannelList rearm_;
+
+    bool setupBufferRing();
+    bool multishotRecvSupported();
+    void recycleBuffers();
+    void handleCompletion(
+        const struct io_uring_cqe &cqe,
+        Request request,
+        ChannelList &activeChannels
+    );
+    void report(Channel *channel, ChannelList &activeChannels);
+    void arm(Channel *channel, Registration &reg);
+    void cancel(Registration &reg);
+    void armOp(Channel *channel, Registration &reg);
+    void cancelOp(Registration &reg);
+    void update(Channel *channel, Registration &reg);
+    struct io_uring_sqe *getSqe();
+    void enter(unsigned minComplete, Nanosecond timeout);
+};
+
+}
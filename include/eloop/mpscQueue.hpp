@@ -0,0 +1,247 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include "eloop/noncopyable.hpp"
+
+
+namespace eloop
+{
+
+// Intrusive lock-free multi-producer/single-consumer queue
+// (Vyukov). push() may be called from any thread, consume()
+// only from the owner thread. Nodes are recycled through a
+// lock-free free list, so steady-state traffic does not allocate.
+template<typename T>
+class MPSCQueue: noncopyable
+{
+public:
+    MPSCQueue()
+        : head_(&stub_),
+          pushed_(0),
+          tail_(&stub_),
+          popped_(0),
+          free_(pack(kNilIndex, 0)),
+          numChunks_(0)
+    {
+        stub_.next.store(nullptr, std::memory_order_relaxed);
+        for (auto &chunk: chunks_)
+            chunk.store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~MPSCQueue()
+    {
+        while (Node *node = pop())
+        {
+            if (node->index == kHeapIndex)
+                delete node;
+        }
+        for (auto &chunk: chunks_)
+            delete[] chunk.load(std::memory_order_relaxed);
+    }
+
+    // thread safe
+    void push(T &&value)
+    {
+        Node *node = allocNode();
+        node->value = std::move(value);
+        push(node);
+    }
+
+    void push(const T &value)
+    {
+        Node *node = allocNode();
+        node->value = value;
+        push(node);
+    }
+
+    // Run f on every element pushed before the call, in FIFO
+    // order. Elements pushed while f runs are left for the next
+    // call. Returns the number of elements consumed.
+    template<typename F>
+    size_t consume(F &&f)
+    {
+        // head_ cannot bound the drain: pop() parks stub_ there while
+        // older nodes may still wait behind tail_
+        uint64_t limit = pushed_.load(std::memory_order_relaxed) - popped_;
+        size_t n = 0;
+        while (n < limit)
+        {
+            Node *node = pop();
+            if (node == nullptr)
+                break;
+            ++popped_;
+            T value(std::move(node->value));
+            node->value = T();
+            freeNode(node);
+            f(value);
+            ++n;
+        }
+        return n;
+    }
+
+    // owner thread only
+    bool empty() const
+    {
+        return tail_ == &stub_ &&
+            stub_.next.load(std::memory_order_acquire) == nullptr;
+    }
+private:
+    static const uint32_t kNilIndex = UINT32_MAX;
+    static const uint32_t kHeapIndex = UINT32_MAX - 1;
+    static const uint32_t kChunkShift = 8;
+    static const uint32_t kChunkSize = 1u << kChunkShift;
+    static const uint32_t kMaxChunks = 1024;
+
+    struct Node
+    {
+        std::atomic<Node*> next{nullptr};
+        std::atomic<uint32_t> freeNext{kNilIndex};
+        uint32_t index = kHeapIndex;
+        T value;
+    };
+
+    // producers push here
+    alignas(64) std::atomic<Node*> head_;
+    // elements pushed so far, linked or about to be
+    std::atomic<uint64_t> pushed_;
+    // owned by the consumer
+    alignas(64) Node *tail_;
+    uint64_t popped_;
+    Node stub_;
+    // free list top: (tag << 32 | index), tag defeats ABA
+    alignas(64) std::atomic<uint64_t> free_;
+    std::atomic<uint32_t> numChunks_;
+    std::atomic<Node*> chunks_[kMaxChunks];
+
+    static uint64_t pack(uint32_t index, uint32_t tag)
+    {
+        return (static_cast<uint64_t>(tag) << 32) | index;
+    }
+
+    static uint32_t indexOf(uint64_t top)
+    {
+        return static_cast<uint32_t>(top);
+    }
+
+    static uint32_t tagOf(uint64_t top)
+    {
+        return static_cast<uint32_t>(top >> 32);
+    }
+
+    Node *nodeAt(uint32_t index)
+    {
+        Node *chunk = chunks_[index >> kChunkShift].load(
+            std::memory_order_acquire
+        );
+        return chunk + (index & (kChunkSize - 1));
+    }
+
+    void link(Node *node)
+    {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        Node *prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    void push(Node *node)
+    {
+        // counted first, so popped_ never overtakes pushed_
+        pushed_.fetch_add(1, std::memory_order_relaxed);
+        link(node);
+    }
+
+    Node *pop()
+    {
+        Node *tail = tail_;
+        Node *next = tail->next.load(std::memory_order_acquire);
+        if (tail == &stub_)
+        {
+            if (next == nullptr)
+                return nullptr;
+            tail_ = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next != nullptr)
+        {
+            tail_ = next;
+            return tail;
+        }
+        // a producer has swapped head_ but not linked yet
+        if (tail != head_.load(std::memory_order_acquire))
+            return nullptr;
+        // stub_ is not an element, it does not count
+        link(&stub_);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next != nullptr)
+        {
+            tail_ = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+    // link [first, last] on top of the free list
+    void pushFree(Node *first, Node *last)
+    {
+        uint64_t top = free_.load(std::memory_order_relaxed);
+        do
+        {
+            last->freeNext.store(indexOf(top), std::memory_order_relaxed);
+        } while (!free_.compare_exchange_weak(
+            top, pack(first->index, tagOf(top) + 1),
+            std::memory_order_release,
+            std::memory_order_relaxed
+        ));
+    }
+
+    Node *allocNode()
+    {
+        uint64_t top = free_.load(std::memory_order_acquire);
+        while (indexOf(top) != kNilIndex)
+        {
+            Node *node = nodeAt(indexOf(top));
+            uint32_t next = node->freeNext.load(std::memory_order_relaxed);
+            if (free_.compare_exchange_weak(
+                    top, pack(next, tagOf(top) + 1),
+                    std::memory_order_acquire,
+                    std::memory_order_acquire))
+                return node;
+        }
+        return allocChunk();
+    }
+
+    Node *allocChunk()
+    {
+        uint32_t c = numChunks_.fetch_add(1, std::memory_order_relaxed);
+        if (c >= kMaxChunks)
+            return new Node;
+
+        Node *chunk = new Node[kChunkSize];
+        for (uint32_t i = 0; i < kChunkSize; i++)
+        {
+            chunk[i].index = (c << kChunkShift) | i;
+            if (i + 1 < kChunkSize)
+                chunk[i].freeNext.store(
+                    chunk[i].index + 1, std::memory_order_relaxed
+                );
+        }
+        chunks_[c].store(chunk, std::memory_order_release);
+        // keep chunk[0], publish the rest
+        pushFree(&chunk[1], &chunk[kChunkSize - 1]);
+        return &chunk[0];
+    }
+
+    void freeNode(Node *node)
+    {
+        if (node->index == kHeapIndex)
+            delete node;
+        else
+            pushFree(node, node);
+    }
+};
+
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "eloop/timestamp.hpp"
+#include "eloop/noncopyable.hpp"
+
+namespace eloop
+{
+
+class Channel;
+class EventLoop;
+
+enum class PollerBackend
+{
+    kEPoll,
+    kIOUring
+};
+
+// I/O multiplexing backend of an EventLoop, only used in loop thread.
+class Poller: noncopyable
+{
+public:
+    using ChannelList = std::vector<Channel*>;
+
+    virtual ~Poller() = default;
+
+    // a negative timeout blocks, zero returns at once
+    virtual void poll(
+        ChannelList &activeChannels,
+        Nanosecond timeout = Nanosecond(-1)
+    ) = 0;
+    virtual void updateChannel(Channel *channel) = 0;
+    // channel is going away, forget about it even if operations on
+    // its fd are still in flight
+    virtual void removeChannel(Channel *channel)
+    {
+        (void)channel;
+    }
+
+    // Reads and accepts itself for channels in completion mode,
+    // see Channel::setCompletion
+    virtual bool completionIO() const
+    {
+        return false;
+    }
+
+    // interest changes that did not need their own syscall
+    virtual uint64_t elidedUpdates() const
+    {
+        return 0;
+    }
+
+    // falls back to epoll when the backend is unavailable
+    static std::unique_ptr<Poller> newPoller(
+        EventLoop *loop, PollerBackend backend, bool completions = true
+    );
+};
+
+}
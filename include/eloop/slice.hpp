@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+
+namespace eloop
+{
+class Buffer;
+
+// Immutable, reference counted bytes. Copying a Slice shares the
+// storage instead of the bytes, so one payload can be queued on any
+// number of connections, on any loop, and is freed when the last
+// copy goes away. The bytes are copied at most once, on construction:
+// strings and Buffers can be moved in, and memory owned elsewhere can
+// be borrowed for as long as a guard object is held.
+class Slice
+{
+public:
+    Slice() noexcept
+        : storage_(nullptr),
+          data_(nullptr),
+          size_(0)
+    {}
+
+    Slice(const char *data, size_t len);
+
+    explicit Slice(std::string_view data)
+        : Slice(data.data(), data.size())
+    {}
+
+    // take the string or the readable bytes of the buffer over
+    explicit Slice(std::string &&str);
+    explicit Slice(Buffer &&buffer);
+
+    // data stays valid while guard is alive, the Slices keep it so
+    static Slice borrow(
+        const char *data,
+        size_t len,
+        std::shared_ptr<const void> guard
+    );
+
+    Slice(const Slice &other) noexcept
+        : storage_(other.storage_),
+          data_(other.data_),
+          size_(other.size_)
+    {
+        if(storage_ != nullptr)
+            storage_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Slice(Slice &&other) noexcept
+        : storage_(other.storage_),
+          data_(other.data_),
+          size_(other.size_)
+    {
+        other.storage_ = nullptr;
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+
+    Slice &operator=(Slice other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~Slice()
+    {
+        unref();
+    }
+
+    void swap(Slice &other) noexcept
+    {
+        std::swap(storage_, other.storage_);
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+    }
+
+    const char *data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    std::string_view view() const
+    {
+        return std::string_view(data_, size_);
+    }
+
+    std::string toString() const
+    {
+        return std::string(data_, size_);
+    }
+
+    // part of the bytes, sharing the same storage
+    Slice subslice(size_t offset, size_t len) const
+    {
+        assert(offset + len <= size_);
+        Slice result(*this);
+        result.data_ += offset;
+        result.size_ = len;
+        return result;
+    }
+
+    void removePrefix(size_t len)
+    {
+        assert(len <= size_);
+        data_ += len;
+        size_ -= len;
+    }
+
+    // number of Slices sharing the storage
+    size_t useCount() const
+    {
+        return storage_ == nullptr ? 0:
+            storage_->refs.load(std::memory_order_relaxed);
+    }
+private:
+    struct Storage
+    {
+        std::atomic<size_t> refs;
+        void (*destroy)(Storage *storage);
+    };
+
+    struct CopyStorage;
+    struct StringStorage;
+    struct BufferStorage;
+    struct BorrowStorage;
+
+    Storage *storage_;
+    const char *data_;
+    size_t size_;
+
+    void unref()
+    {
+        if(storage_ != nullptr &&
+           storage_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            storage_->destroy(storage_);
+    }
+};
+
+}
@@ -24,7 +24,6 @@ public:
     );
     ~ThreadPool();
 
-    void runTask(const Task &task);
     void runTask(Task &&task);
     void stop();
     size_t numThreads() const
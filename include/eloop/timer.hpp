@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
 #include "eloop/callback.hpp"
 #include "eloop/channel.hpp"
 #include "eloop/timestamp.hpp"
@@ -9,17 +10,76 @@
 namespace eloop
 {
 
+// Handle of a timer returned by EventLoop::runAt/runAfter/runEvery.
+// The generation makes a handle stale once its timer has fired or
+// been canceled, canceling a stale handle does nothing.
+class TimerId
+{
+public:
+    TimerId(): index_(kInvalidIndex), generation_(0) {}
+
+    TimerId(uint32_t index, uint32_t generation)
+        : index_(index),
+          generation_(generation)
+    {}
+
+    bool valid() const
+    {
+        return index_ != kInvalidIndex;
+    }
+
+    uint32_t index() const
+    {
+        return index_;
+    }
+
+    uint32_t generation() const
+    {
+        return generation_;
+    }
+private:
+    static const uint32_t kInvalidIndex = UINT32_MAX;
+
+    uint32_t index_;
+    uint32_t generation_;
+};
+
 class Timer: noncopyable
 {
 public:
-    Timer(TimerCallback callback, Timestamp when, Nanosecond interval)
-        : callback_(callback),
-          when_(when),
-          interval_(interval),
-          repeat_(interval > Nanosecond::zero()),
+    Timer()
+        : interval_(Nanosecond::zero()),
+          slack_(Nanosecond::zero()),
+          repeat_(false),
           canceled_(false)
     {}
 
+    Timer(
+        TimerCallback callback,
+        MonoTimestamp when,
+        Nanosecond interval,
+        Nanosecond slack = Nanosecond::zero()
+    )
+    {
+        reset(std::move(callback), when, interval, slack);
+    }
+
+    void reset(
+        TimerCallback callback,
+        MonoTimestamp when,
+        Nanosecond interval,
+        Nanosecond slack = Nanosecond::zero()
+    )
+    {
+        callback_ = std::move(callback);
+        when_ = when;
+        interval_ = interval;
+        slack_ = slack > Nanosecond::zero() ? slack: Nanosecond::zero();
+        repeat_ = interval > Nanosecond::zero();
+        canceled_ = false;
+        updateExpiration();
+    }
+
     void run()
     {
         if(callback_)
@@ -31,25 +91,39 @@ public:
         return repeat_;
     }
 
-    bool expired(Timestamp now) const
+    bool expired(MonoTimestamp now) const
     {
         return now >= when_;
     }
 
-    Timestamp when() const
+    MonoTimestamp when() const
     {
         return when_;
     }
 
+    // When the timer is actually due: when() pushed forward by at
+    // most slack() onto a grid shared by timers of similar slack, so
+    // neighbouring deadlines collapse into one wakeup.
+    MonoTimestamp expiration() const
+    {
+        return expiration_;
+    }
+
+    Nanosecond slack() const
+    {
+        return slack_;
+    }
+
     void restart()
     {
         assert(repeat_);
+        // the period follows when_, slack never accumulates
         when_ += interval_;
+        updateExpiration();
     }
     
     void cancel()
     {
-        assert(!canceled_);
         canceled_ = true;
     }
 
@@ -57,12 +131,50 @@ public:
     {
         return canceled_;
     }
+
+    // release the callback's captures
+    void clear()
+    {
+        callback_ = nullptr;
+    }
+
+    // TimerQueue pool bookkeeping: slot, generation of the slot,
+    // and whether the timer sits in the TimerStore
+    uint32_t poolIndex = 0;
+    uint32_t poolGeneration = 0;
+    bool stored = false;
+
+    // TimingWheel bookkeeping
+    Timer *wheelPrev = nullptr;
+    Timer *wheelNext = nullptr;
+    Timer **wheelSlot = nullptr;
+    uint64_t wheelTick = 0;
 private:
     TimerCallback callback_;
-    Timestamp when_;
-    const Nanosecond interval_;
+    MonoTimestamp when_;
+    MonoTimestamp expiration_;
+    Nanosecond interval_;
+    Nanosecond slack_;
     bool repeat_;
     bool canceled_;
+
+    void updateExpiration()
+    {
+        expiration_ = when_;
+        if(slack_ <= Nanosecond::zero())
+            return;
+        // round up to the largest power of two not above slack
+        uint64_t slack = static_cast<uint64_t>(slack_.count());
+        int64_t grain = static_cast<int64_t>(
+            1ULL << (63 - __builtin_clzll(slack))
+        );
+        int64_t ns = when_.time_since_epoch().count();
+        int64_t rem = ns % grain;
+        if(rem < 0)
+            rem += grain;
+        if(rem != 0)
+            expiration_ += Nanosecond(grain - rem);
+    }
 };
 
 }
@@ -1,34 +1,104 @@
 #pragma once
 
 #include <memory>
-#include <set>
+#include <mutex>
 #include <vector>
 #include "eloop/timer.hpp"
+#include "eloop/timerStore.hpp"
 #include "eloop/channel.hpp"
 #include "eloop/noncopyable.hpp"
 
 namespace eloop
 {
 
+enum class TimerBackend
+{
+    kOrderedSet,
+    kTimingWheel
+};
+
+// What wakes the loop for the next timer: a timerfd channel, or
+// the timeout of the poller wait itself (no timerfd syscalls, due
+// timers run right after polling).
+enum class TimerSource
+{
+    kTimerfd,
+    kPollTimeout
+};
+
 class TimerQueue: noncopyable
 {
 public:
-    explicit TimerQueue(EventLoop *loop);
+    // tick is the TimingWheel granularity
+    TimerQueue(
+        EventLoop *loop,
+        TimerBackend backend = TimerBackend::kOrderedSet,
+        Nanosecond tick = 1ms,
+        TimerSource source = TimerSource::kTimerfd
+    );
     ~TimerQueue();
 
-    Timer *addTimer(TimerCallback cb, Timestamp when, Nanosecond interval);
-    void cancelTimer(Timer *timer);
+    // thread safe, slack lets the timer fire up to that much late
+    // so it can share a wakeup with its neighbours
+    TimerId addTimer(
+        TimerCallback cb,
+        MonoTimestamp when,
+        Nanosecond interval,
+        Nanosecond slack = Nanosecond::zero()
+    );
+    void cancelTimer(TimerId id);
+
+    // loop thread only: wakeups that ran at least one timer, and
+    // timers run; their difference is the wakeups saved by batching
+    uint64_t timerWakeups() const
+    {
+        return timerWakeups_;
+    }
+
+    uint64_t timersFired() const
+    {
+        return timersFired_;
+    }
+
+    bool drivenByPoll() const
+    {
+        return source_ == TimerSource::kPollTimeout;
+    }
+
+    // time left until the next timer is due, zero if one is overdue
+    // and negative if there is none
+    Nanosecond timeUntilNext(MonoTimestamp now) const;
+    // kPollTimeout only: run the timers due at now
+    void runExpired(MonoTimestamp now);
 private:
-    using Entry = std::pair<Timestamp, Timer*>;
-    using TimerList = std::set<Entry>;
+    using TimerChunk = std::unique_ptr<Timer[]>;
+    static const uint32_t kChunkSize = 256;
 
     EventLoop *loop_;
+    const TimerSource source_;
     const int timerfd_;
     Channel timerChannel_;
-    TimerList timers_;
+    std::unique_ptr<TimerStore> timers_;
+    std::vector<Timer*> expired_;
+    // deadline the timerfd is set to
+    MonoTimestamp armed_;
+    uint64_t timerWakeups_;
+    uint64_t timersFired_;
+
+    // Timer slab, slots are recycled so timer churn does not
+    // allocate. Guarded by poolMutex_ since addTimer may be called
+    // from any thread.
+    std::mutex poolMutex_;
+    std::vector<TimerChunk> chunks_;
+    std::vector<uint32_t> freeSlots_;
 
+    Timer *allocTimer();
+    void freeTimer(Timer *timer);
+    Timer *findTimer(TimerId id);
+    void insert(Timer *timer);
+    void arm(MonoTimestamp when);
+    void expire(MonoTimestamp now);
     void handleRead();
-    std::vector<Entry> getExpired(Timestamp now);
 };
 
 }
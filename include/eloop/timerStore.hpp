@@ -0,0 +1,85 @@
+#pragma once
+
+#include <set>
+#include <vector>
+#include "eloop/timer.hpp"
+#include "eloop/timestamp.hpp"
+#include "eloop/noncopyable.hpp"
+
+namespace eloop
+{
+
+// Pending timers of a TimerQueue, ordered by Timer::expiration().
+class TimerStore: noncopyable
+{
+public:
+    virtual ~TimerStore() = default;
+
+    virtual void insert(Timer *timer) = 0;
+    // no-op if timer is not stored
+    virtual void erase(Timer *timer) = 0;
+    // move every timer due at now into expired
+    virtual void popExpired(
+        MonoTimestamp now,
+        std::vector<Timer*> &expired
+    ) = 0;
+    virtual void popAll(std::vector<Timer*> &all) = 0;
+    virtual bool empty() const = 0;
+    virtual size_t size() const = 0;
+    // no timer fires before this, only valid if !empty()
+    virtual MonoTimestamp nextExpiration() const = 0;
+};
+
+// std::set based store, O(log n) insert/erase.
+class TimerSet: public TimerStore
+{
+public:
+    void insert(Timer *timer) override
+    {
+        auto ret = timers_.insert({timer->expiration(), timer});
+        assert(ret.second);
+        (void)ret;
+    }
+
+    void erase(Timer *timer) override
+    {
+        timers_.erase({timer->expiration(), timer});
+    }
+
+    void popExpired(MonoTimestamp now, std::vector<Timer*> &expired) override
+    {
+        Entry en(now + 1ns, nullptr);
+        auto end = timers_.lower_bound(en);
+        for (auto it = timers_.begin(); it != end; ++it)
+            expired.push_back(it->second);
+        timers_.erase(timers_.begin(), end);
+    }
+
+    void popAll(std::vector<Timer*> &all) override
+    {
+        for (auto &e: timers_)
+            all.push_back(e.second);
+        timers_.clear();
+    }
+
+    bool empty() const override
+    {
+        return timers_.empty();
+    }
+
+    size_t size() const override
+    {
+        return timers_.size();
+    }
+
+    MonoTimestamp nextExpiration() const override
+    {
+        assert(!timers_.empty());
+        return timers_.begin()->first;
+    }
+private:
+    using Entry = std::pair<MonoTimestamp, Timer*>;
+    std::set<Entry> timers_;
+};
+
+}
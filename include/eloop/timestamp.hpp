@@ -1,6 +1,7 @@
 #pragma once
 
 #include <chrono>
+#include <ctime>
 
 
 namespace eloop
@@ -14,6 +15,9 @@ using Second = std::chrono::seconds;
 using Minute = std::chrono::minutes;
 using Hour = std::chrono::hours;
 using Timestamp = std::chrono::time_point<std::chrono::system_clock, Nanosecond>;
+// CLOCK_MONOTONIC based, used for timer scheduling
+using MonoTimestamp =
+    std::chrono::time_point<std::chrono::steady_clock, Nanosecond>;
 
 
 namespace clock
@@ -34,6 +38,20 @@ inline Timestamp nowBefore(Nanosecond interval)
     return now() - interval;
 }
 
+inline MonoTimestamp monoNow()
+{
+    return std::chrono::steady_clock::now();
+}
+
+// CLOCK_MONOTONIC_COARSE: same timeline as monoNow(), cheaper to
+// read but only as fine as the kernel tick (typically 1-4ms)
+inline MonoTimestamp monoCoarseNow()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return MonoTimestamp(Second(ts.tv_sec) + Nanosecond(ts.tv_nsec));
+}
+
 }
 
 
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include "eloop/timerStore.hpp"
+
+namespace eloop
+{
+
+// Hierarchical timing wheel, O(1) insert/erase. Level l has 64 slots
+// of 64^l ticks each; a timer sits in the lowest level whose span
+// still contains its deadline and is cascaded down as time advances.
+// Timers fire on the first tick boundary at or after their deadline.
+class TimingWheel: public TimerStore
+{
+public:
+    static const int kLevelBits = 6;
+    static const int kSlots = 1 << kLevelBits;
+    static const int kLevels = 6;
+
+    TimingWheel(MonoTimestamp start, Nanosecond tick);
+
+    void insert(Timer *timer) override;
+    void erase(Timer *timer) override;
+    void popExpired(MonoTimestamp now, std::vector<Timer*> &expired) override;
+    void popAll(std::vector<Timer*> &all) override;
+
+    bool empty() const override
+    {
+        return size_ == 0;
+    }
+
+    size_t size() const override
+    {
+        return size_;
+    }
+
+    MonoTimestamp nextExpiration() const override;
+private:
+    const MonoTimestamp start_;
+    const Nanosecond tick_;
+    // ticks up to and including current_ have been expired
+    uint64_t current_;
+    size_t size_;
+    Timer *slots_[kLevels][kSlots];
+    uint64_t occupied_[kLevels];
+    // already due when inserted
+    Timer *ready_;
+    // beyond the top level
+    Timer *overflow_;
+
+    uint64_t tickOf(MonoTimestamp when) const;
+    MonoTimestamp timeOf(uint64_t tick) const;
+    void place(Timer *timer);
+    void link(Timer **slot, Timer *timer);
+    void unlink(Timer *timer);
+    void moveAll(Timer **slot, std::vector<Timer*> &out);
+    void cascade(Timer **slot);
+    void advance();
+};
+
+}
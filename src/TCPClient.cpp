@@ -19,7 +19,6 @@ TCPClient::TCPClient(EventLoop *loop, const InetAddress &peer)
     : loop_(loop),
       connected_(false),
       peer_(peer),
-      retryTimer_(nullptr),
       connector_(new Connector(loop, peer)),
       connectionCallback_(defaultConnectionCallback),
       messageCallback_(defaultMessageCallback)
@@ -40,7 +39,7 @@ TCPClient::~TCPClient()
 {
     if (connection_ && !connection_->disconnected())
         connection_->forceClose();
-    if (retryTimer_ != nullptr)
+    if (retryTimer_.valid())
         loop_->cancelTimer(retryTimer_);
 }
 
@@ -86,7 +85,7 @@ void TCPClient::newConnection(
 {
     loop_->assertInLoopThread();
     loop_->cancelTimer(retryTimer_);
-    retryTimer_ = nullptr;
+    retryTimer_ = TimerId();
     connected_ = true;
     auto conn = std::make_shared<TCPConnection>(
         loop_, connfd, local, peer
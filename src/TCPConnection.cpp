@@ -1,5 +1,15 @@
+#include <algorithm>
 #include <cassert>
+#include <climits>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
 #include "eloop/log.hpp"
 #include "eloop/eventLoop.hpp"
 #include "eloop/TCPConnection.hpp"
@@ -45,6 +55,20 @@ void defaultMessageCallback(
     buffer.retrieveAll();
 }
 
+void defaultChainMessageCallback(
+    const TCPConnectionPtr &conn,
+    ChainBuffer &buffer
+)
+{
+    TRACE(
+        "connection %s -> %s recv %lu bytes",
+        conn->peer().toIPPort().c_str(),
+        conn->local().toIPPort().c_str(),
+        buffer.readableBytes()
+    );
+    buffer.retrieveAll();
+}
+
 
 TCPConnection::TCPConnection(
     EventLoop *loop,
@@ -57,12 +81,50 @@ TCPConnection::TCPConnection(
    state_(kConnecting),
    local_(local),
    peer_(peer),
-   highWaterMark_(0)
+   inputBuffer_(Buffer::kInitialSize, &loop->bufferPool()),
+   outputBuffer_(Buffer::kInitialSize, &loop->bufferPool()),
+   chained_(false),
+   inputChain_(&loop->bufferPool()),
+   outputChain_(&loop->bufferPool()),
+   queuedBytes_(0),
+   pending_(nullptr),
+   highWaterMark_(0),
+   backpressureHigh_(0),
+   backpressureLow_(0),
+   throttling_(false),
+   readStopped_(false),
+   readPauseCount_(0),
+   readPauses_(0),
+   readPausedTime_(0),
+   autoCork_(false),
+   flushQueued_(false),
+   zeroCopy_(false),
+   zeroCopyThreshold_(kDefaultZeroCopyThreshold),
+   zeroCopyNextId_(0),
+   zeroCopyCompleted_(0),
+   zeroCopyCopied_(0),
+   edgeTriggered_(false),
+   readBudget_(kDefaultReadBudget),
+   readBudgetReads_(kDefaultReadBudgetReads),
+   readBudgetExhausted_(0),
+   readRequeued_(false),
+   recvTaken_(0),
+   recvIteration_(0),
+   recvHeld_(&loop->bufferPool()),
+   chainMessageCallback_(defaultChainMessageCallback)
 {
     channel_.setReadCallback([this](){handleRead();});
     channel_.setWriteCallback([this](){handleWrite();});
     channel_.setCloseCallback([this](){handleClose();});
     channel_.setErrorCallback([this](){handleError();});
+    if(loop_->completionIO())
+        channel_.setCompletion(
+            Channel::CompletionOp::kRecv,
+            [this](int res, const char *data)
+            {
+                handleRecvCompletion(res, data);
+            }
+        );
 
     TRACE(
         "TCPConnection() %s fd=%d",
@@ -74,6 +136,13 @@ TCPConnection::TCPConnection(
 TCPConnection::~TCPConnection()
 {
     assert(state_ == kDisconnected);
+    PendingSend *node = pending_.exchange(nullptr);
+    while (node != nullptr)
+    {
+        PendingSend *next = node->next;
+        dropPending(node);
+        node = next;
+    }
     ::close(sockfd_);
 
     TRACE(
@@ -85,10 +154,21 @@ TCPConnection::~TCPConnection()
 
 void TCPConnection::connectEstablished()
 {
-    assert(state_ = kConnecting);
+    assert(state_ == kConnecting);
     state_ = kConnected;
     channel_.tie(shared_from_this());
-    channel_.enableRead();
+
+    int busyPollUs = loop_->socketBusyPollUs();
+    if(busyPollUs > 0)
+    {
+        int ret = ::setsockopt(
+            sockfd_, SOL_SOCKET, SO_BUSY_POLL,
+            &busyPollUs, sizeof(busyPollUs)
+        );
+        if(ret == -1)
+            SYSERR("TCPConnection::setsockopt SO_BUSY_POLL");
+    }
+    updateReadInterest();
 }
 
 bool TCPConnection::connected() const
@@ -106,6 +186,11 @@ void TCPConnection::send(std::string_view data)
     send(data.begin(), data.length());
 }
 
+void TCPConnection::send(const char *data)
+{
+    send(std::string_view(data));
+}
+
 void TCPConnection::send(const char *data, size_t len)
 {
     if(state_ != kConnected)
@@ -117,18 +202,25 @@ void TCPConnection::send(const char *data, size_t len)
     }
     
     if(loop_->isInLoopThread())
-    {
         sendInLoop(data, len);
-    }
     else
+        sendPending(OutputSegment(Slice(data, len)));
+}
+
+void TCPConnection::send(std::string &&message)
+{
+    if(state_ != kConnected)
     {
-        loop_->queueInLoop(
-            [ptr = shared_from_this(), str = std::string(data, data + len)]()
-            {
-                ptr->sendInLoop(str);
-            }
+        WARN(
+            "TCPConnection::send() not connected, give up send."
         );
+        return;
     }
+
+    if(loop_->isInLoopThread())
+        sendInLoop(message.data(), message.size());
+    else
+        sendPending(OutputSegment(Slice(std::move(message))));
 }
 
 void TCPConnection::send(Buffer &buffer)
@@ -140,220 +232,1335 @@ void TCPConnection::send(Buffer &buffer)
         );
         return;
     }
-     if(loop_->isInLoopThread())
-     {
-         sendInLoop(buffer.peek(), buffer.readableBytes());
-         buffer.retrieveAll();
-     }
-     else
-     {
-         loop_->queueInLoop(
-             [ptr = shared_from_this(), str = buffer.retrieveAllAsString()]()
-             {
-                 ptr->sendInLoop(str);
-             }
-         );
-     }
+    if(loop_->isInLoopThread())
+        sendInLoop(buffer.peek(), buffer.readableBytes());
+    else
+        sendPending(OutputSegment(
+            Slice(buffer.peek(), buffer.readableBytes())
+        ));
+    buffer.retrieveAll();
 }
 
-void TCPConnection::sendInLoop(const char *data, size_t len)
+void TCPConnection::send(Buffer &&buffer)
 {
-    loop_->assertInLoopThread();
-    
-    if(state_ == kConnected)
+    if(state_ != kConnected)
     {
         WARN(
-            "TCPConnection::sendInLoop() dsiconncted, give up send."
+            "TCPConnection::send() not connected, give up send."
         );
         return;
     }
-
-    ssize_t n = 0;
-    size_t remain = len;
-    bool faultError = false;
-
-    if(!channel_.isWriting())
+    if(loop_->isInLoopThread())
     {
-        assert(outputBuffer_.readableBytes() == 0);
-        n = ::write(sockfd_, data, len);
-        if(n == -1)
-        {
-            if(errno != EAGAIN)
-            {
-                SYSERR("TCPConnection::write().");
-                if(errno == EPIPE || errno == ECONNRESET)
-                    faultError = true;
-            }
-            n = 0;
-        }
-        else
-        {
-            remain -= static_cast<size_t>(n);
-            if(remain == 0 && writeCompleteCallback_)
-            {
-                loop_->queueInLoop(
-                    std::bind(
-                        writeCompleteCallback_,
-                        shared_from_this()
-                    )
-                );
-            }
-        }
+        sendInLoop(buffer.peek(), buffer.readableBytes());
+        buffer.retrieveAll();
     }
-
-    // TODO: add highWaterMark
-    if (!faultError && remain > 0)
+    else
     {
-        if(highWaterMark_)
-        {
-            size_t oldLen = outputBuffer_.readableBytes();
-            size_t newLen = oldLen + remain;
-            if (oldLen < highWaterMark_ && newLen >= highWaterMark_)
-                loop_->queueInLoop(
-                    std::bind(
-                        highWaterMarkCallback_,
-                        shared_from_this(), newLen
-                    )
-                );
-        }
-        outputBuffer_.append(data + n, remain);
-        channel_.enableRead();
+        // the storage changes hands, no copy
+        sendPending(OutputSegment(Slice(std::move(buffer))));
     }
 }
 
-void TCPConnection::sendInLoop(const std::string &message)
+void TCPConnection::send(ChainBuffer &buffer)
 {
-    sendInLoop(message.data(), message.size());
+    if(state_ != kConnected)
+    {
+        WARN(
+            "TCPConnection::send() not connected, give up send."
+        );
+        return;
+    }
+    if(loop_->isInLoopThread())
+    {
+        sendInLoop(buffer);
+    }
+    else
+    {
+        // the blocks change hands, no copy, and may outlive the
+        // loop whose pool they came from
+        auto node = new PendingSend(std::move(buffer));
+        node->chain.detachPool();
+        pushPending(node, node);
+    }
 }
 
-void TCPConnection::shutdownInLoop()
+void TCPConnection::send(const Slice &slice)
 {
-    loop_->assertInLoopThread();
-    if(state_ != kDisconnected && !channel_.isWriting())
+    if(state_ != kConnected)
     {
-        if(::shutdown(sockfd_, SHUT_WR) == -1)
-            SYSERR("TCPConnection::shutdown()");
+        WARN(
+            "TCPConnection::send() not connected, give up send."
+        );
+        return;
     }
+    if(loop_->isInLoopThread())
+        sendInLoop(slice);
+    else
+        sendPending(OutputSegment(slice));
 }
 
-void TCPConnection::forceCloseInLoop()
+void TCPConnection::send(std::vector<Slice> segments)
 {
-    loop_->assertInLoopThread();
-    if(state_ != kDisconnected)
-        handleClose();
+    if(state_ != kConnected)
+    {
+        WARN(
+            "TCPConnection::send() not connected, give up send."
+        );
+        return;
+    }
+    if(loop_->isInLoopThread())
+    {
+        sendInLoop(segments);
+        return;
+    }
+
+    // pushed at once, so sends from other threads cannot cut in
+    PendingSend *newest = nullptr;
+    PendingSend *oldest = nullptr;
+    for (auto &segment: segments)
+    {
+        if(segment.empty())
+            continue;
+        auto node = new PendingSend(OutputSegment(std::move(segment)));
+        node->next = newest;
+        newest = node;
+        if(oldest == nullptr)
+            oldest = node;
+    }
+    if(newest != nullptr)
+        pushPending(newest, oldest);
 }
 
-void TCPConnection::shutdown()
+void TCPConnection::sendPending(OutputSegment &&segment)
 {
-    assert(state_ <= kDisconnected);
+    auto node = new PendingSend(std::move(segment));
+    pushPending(node, node);
+}
 
-    if(stateAtomicGetAndSet(kDisconnecting) == kConnected)
+void TCPConnection::pushPending(PendingSend *newest, PendingSend *oldest)
+{
+    PendingSend *head = pending_.load(std::memory_order_relaxed);
+    do
     {
-        if(loop_->isInLoopThread())
-            shutdownInLoop();
-        else
-            loop_->queueInLoop(
-                std::bind(
-                    &TCPConnection::shutdownInLoop,
-                    shared_from_this()
-                )
-            );
-    }
+        oldest->next = head;
+    } while (!pending_.compare_exchange_weak(
+        head, newest,
+        std::memory_order_release,
+        std::memory_order_relaxed
+    ));
+
+    if(head == nullptr)
+        loop_->queueInLoop(
+            [ptr = shared_from_this()]()
+            {
+                ptr->flushPending();
+            }
+        );
 }
 
-void TCPConnection::forceClose()
+void TCPConnection::flushPending()
 {
-    if(state_ != kDisconnected)
+    loop_->assertInLoopThread();
+    PendingSend *node = pending_.exchange(
+        nullptr, std::memory_order_acquire
+    );
+    // back into send order
+    PendingSend *ordered = nullptr;
+    while (node != nullptr)
     {
-        if(stateAtomicGetAndSet(kDisconnecting) == kConnected)
+        PendingSend *next = node->next;
+        node->next = ordered;
+        ordered = node;
+        node = next;
+    }
+
+    if(state_ == kDisconnected)
+    {
+        WARN(
+            "TCPConnection::flushPending() dsiconncted, give up send."
+        );
+        while (ordered != nullptr)
         {
-            loop_->queueInLoop(
-                std::bind(
-                    &TCPConnection::forceCloseInLoop,
-                    shared_from_this()
-                )
-            );
+            PendingSend *next = ordered->next;
+            dropPending(ordered);
+            ordered = next;
         }
+        return;
+    }
+
+    size_t oldLen = outputBytes();
+    while (ordered != nullptr)
+    {
+        PendingSend *next = ordered->next;
+        if(ordered->chain.readableBytes() > 0)
+            queueChain(ordered->chain);
+        else
+            queueSegment(std::move(ordered->segment));
+        delete ordered;
+        ordered = next;
     }
+    if(outputBytes() > oldLen)
+        flushQueuedOutput(oldLen);
 }
 
-int TCPConnection::stateAtomicGetAndSet(int newState)
+void TCPConnection::dropPending(PendingSend *node)
 {
-    return __atomic_exchange_n(&state_, newState, __ATOMIC_SEQ_CST);
+    if(node->segment.fd != -1)
+        ::close(node->segment.fd);
+    delete node;
 }
 
-void TCPConnection::stopRead()
+void TCPConnection::queueSegment(OutputSegment &&segment)
 {
-    loop_->runInLoop(
-        [this]()
-        {
-            if(channel_.isReading())
-                channel_.dsiableRead();
-        }
-    );
+    if(segment.size() == 0)
+        return;
+    queuedBytes_ += segment.size();
+    outputQueue_.push_back(std::move(segment));
 }
 
-void TCPConnection::startRead()
+void TCPConnection::sendInLoop(std::vector<Slice> &segments)
 {
-    loop_->runInLoop(
-        std::bind(
-            [this]()
-            {
-                if(!channel_.isReading())
-                    channel_.enableRead();
-            }
-        )
-    );
+    loop_->assertInLoopThread();
+    if(state_ == kDisconnected)
+    {
+        WARN(
+            "TCPConnection::sendInLoop() dsiconncted, give up send."
+        );
+        return;
+    }
+
+    size_t oldLen = outputBytes();
+    for (auto &segment: segments)
+        queueSegment(OutputSegment(std::move(segment)));
+    if(outputBytes() > oldLen)
+        flushQueuedOutput(oldLen);
 }
 
-void TCPConnection::handleRead()
+void TCPConnection::sendInLoop(const Slice &slice)
 {
     loop_->assertInLoopThread();
-    assert(state_ != kDisconnected);
-    int savedErrno;
-    ssize_t n = inputBuffer_.readFD(sockfd_, &savedErrno);
-    if(n == -1)
+    if(state_ == kDisconnected)
     {
-        errno = savedErrno;
-        SYSERR("TCPConnection::read()");
-        handleError();
+        WARN(
+            "TCPConnection::sendInLoop() dsiconncted, give up send."
+        );
+        return;
     }
-    else if(n == 0)
+    if(slice.empty())
+        return;
+
+    size_t oldLen = outputBytes();
+    queueSegment(OutputSegment(slice));
+    flushQueuedOutput(oldLen);
+}
+
+void TCPConnection::sendFile(int fd, off_t offset, size_t length)
+{
+    if(state_ != kConnected)
     {
-        handleClose();
+        WARN(
+            "TCPConnection::sendFile() not connected, give up send."
+        );
+        return;
     }
-    else
+    struct stat st;
+    if(::fstat(fd, &st) == -1)
     {
-        messageCallback_(shared_from_this(), inputBuffer_);
+        SYSERR("TCPConnection::sendFile() fstat");
+        return;
+    }
+    if(!S_ISREG(st.st_mode) && !S_ISFIFO(st.st_mode))
+    {
+        WARN(
+            "TCPConnection::sendFile() fd=%d is neither a file nor a pipe.",
+            fd
+        );
+        return;
+    }
+    if(length == 0)
+        return;
+    int dupfd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if(dupfd == -1)
+    {
+        SYSERR("TCPConnection::sendFile() dup");
+        return;
     }
+
+    bool pipe = S_ISFIFO(st.st_mode);
+    if(loop_->isInLoopThread())
+        sendFileInLoop(dupfd, pipe, offset, length);
+    else
+        sendPending(OutputSegment(dupfd, pipe, offset, length));
 }
 
-void TCPConnection::handleWrite()
+void TCPConnection::sendFileInLoop(
+    int fd,
+    bool pipe,
+    off_t offset,
+    size_t length
+)
 {
+    loop_->assertInLoopThread();
     if(state_ == kDisconnected)
     {
         WARN(
-            "TCPConnection::handleWrite() dsiconnected,"
-            "give up write %lu bytes.",
-            outputBuffer_.readableBytes()
+            "TCPConnection::sendFileInLoop() dsiconncted, give up send."
         );
+        ::close(fd);
         return;
     }
 
-    assert(outputBuffer_.readableBytes() > 0);
-    assert(channel_.isWriting());
-    size_t n = ::write(
-        sockfd_, outputBuffer_.peek(), outputBuffer_.readableBytes()
-    );
+    size_t oldLen = outputBytes();
+    queueSegment(OutputSegment(fd, pipe, offset, length));
+    flushQueuedOutput(oldLen);
+}
 
-    if(n == -1)
+// Output was queued on top of oldLen bytes, write it now unless
+// handleWrite will, or at the end of the iteration when corked.
+void TCPConnection::flushQueuedOutput(size_t oldLen)
+{
+    if(highWaterMark_ && oldLen < highWaterMark_ &&
+       outputBytes() >= highWaterMark_)
+        loop_->queueInLoop(
+            std::bind(
+                highWaterMarkCallback_,
+                shared_from_this(), outputBytes()
+            )
+        );
+    updateBackpressure();
+    if(waitingToWrite())
+        return;
+
+    if(autoCork_)
     {
-        SYSERR("TCPConnection::write()");
+        if(!flushQueued_)
+        {
+            flushQueued_ = true;
+            loop_->queueAtIterationEnd(
+                [ptr = shared_from_this()]()
+                {
+                    ptr->flushQueued_ = false;
+                    ptr->flushInLoop();
+                }
+            );
+        }
+        return;
+    }
+    writeQueuedOutput();
+}
+
+void TCPConnection::writeQueuedOutput()
+{
+    if(waitingToWrite() || outputBytes() == 0)
+        return;
+
+    if(writeOutput() == -1 && errno != EAGAIN)
+        SYSERR("TCPConnection::writev().");
+    updateBackpressure();
+    if(outputBytes() > 0)
+    {
+        if(!waitingForPipe())
+            channel_.enableWrite();
+        return;
+    }
+    outputBuffer_.release();
+    outputChain_.release();
+    if(writeCompleteCallback_)
+        loop_->queueInLoop(
+            std::bind(
+                writeCompleteCallback_,
+                shared_from_this()
+            )
+        );
+}
+
+void TCPConnection::sendInLoop(ChainBuffer &chain)
+{
+    loop_->assertInLoopThread();
+    if(!chained_)
+    {
+        chain.forEachSegment(
+            [this](const char *data, size_t len)
+            {
+                sendInLoop(data, len);
+            }
+        );
+        chain.retrieveAll();
+        return;
+    }
+
+    if(state_ == kDisconnected)
+    {
+        WARN(
+            "TCPConnection::sendInLoop() dsiconncted, give up send."
+        );
+        return;
+    }
+
+    size_t oldLen = outputBytes();
+    queueChain(chain);
+    flushQueuedOutput(oldLen);
+}
+
+void TCPConnection::queueChain(ChainBuffer &chain)
+{
+    if(chained_ && outputQueue_.empty())
+    {
+        outputChain_.append(std::move(chain));
+        return;
+    }
+    // copied, behind the queued segments if there are any
+    chain.forEachSegment(
+        [this](const char *data, size_t len)
+        {
+            appendOutput(data, len);
+        }
+    );
+    chain.retrieveAll();
+}
+
+void TCPConnection::sendInLoop(const char *data, size_t len)
+{
+    loop_->assertInLoopThread();
+    
+    if(state_ == kDisconnected)
+    {
+        WARN(
+            "TCPConnection::sendInLoop() dsiconncted, give up send."
+        );
+        return;
+    }
+
+    if(zeroCopy_ && len >= zeroCopyThreshold_)
+    {
+        // one copy into storage the kernel can pin
+        sendInLoop(Slice(data, len));
+        return;
+    }
+
+    if(autoCork_)
+    {
+        size_t oldLen = outputBytes();
+        appendOutput(data, len);
+        flushQueuedOutput(oldLen);
+        return;
+    }
+
+    ssize_t n = 0;
+    size_t remain = len;
+    bool faultError = false;
+
+    if(!waitingToWrite())
+    {
+        assert(outputBytes() == 0);
+        n = ::write(sockfd_, data, len);
+        if(n == -1)
+        {
+            if(errno != EAGAIN)
+            {
+                SYSERR("TCPConnection::write().");
+                if(errno == EPIPE || errno == ECONNRESET)
+                    faultError = true;
+            }
+            n = 0;
+        }
+        else
+        {
+            remain -= static_cast<size_t>(n);
+            if(remain == 0 && writeCompleteCallback_)
+            {
+                loop_->queueInLoop(
+                    std::bind(
+                        writeCompleteCallback_,
+                        shared_from_this()
+                    )
+                );
+            }
+        }
+    }
+
+    if (!faultError && remain > 0)
+    {
+        if(highWaterMark_)
+        {
+            size_t oldLen = outputBytes();
+            size_t newLen = oldLen + remain;
+            if (oldLen < highWaterMark_ && newLen >= highWaterMark_)
+                loop_->queueInLoop(
+                    std::bind(
+                        highWaterMarkCallback_,
+                        shared_from_this(), newLen
+                    )
+                );
+        }
+        appendOutput(data + n, remain);
+        updateBackpressure();
+        if(!waitingToWrite())
+            channel_.enableWrite();
+    }
+}
+
+void TCPConnection::flush()
+{
+    loop_->runInLoop(
+        [ptr = shared_from_this()]()
+        {
+            ptr->flushInLoop();
+        }
+    );
+}
+
+void TCPConnection::flushInLoop()
+{
+    loop_->assertInLoopThread();
+    if(state_ != kDisconnected)
+        writeQueuedOutput();
+}
+
+void TCPConnection::setAutoCork(bool on)
+{
+    loop_->assertInLoopThread();
+    autoCork_ = on;
+    if(!on)
+        flushInLoop();
+}
+
+void TCPConnection::shutdownInLoop()
+{
+    loop_->assertInLoopThread();
+    // corked output goes first, handleWrite shuts down if it
+    // does not fit
+    flushInLoop();
+    if(state_ != kDisconnected && !waitingToWrite())
+    {
+        if(::shutdown(sockfd_, SHUT_WR) == -1)
+            SYSERR("TCPConnection::shutdown()");
+    }
+}
+
+void TCPConnection::forceCloseInLoop()
+{
+    loop_->assertInLoopThread();
+    if(state_ != kDisconnected)
+        handleClose();
+}
+
+void TCPConnection::shutdown()
+{
+    assert(state_ <= kDisconnected);
+
+    if(stateAtomicGetAndSet(kDisconnecting) == kConnected)
+    {
+        if(loop_->isInLoopThread())
+            shutdownInLoop();
+        else
+            loop_->queueInLoop(
+                std::bind(
+                    &TCPConnection::shutdownInLoop,
+                    shared_from_this()
+                )
+            );
+    }
+}
+
+void TCPConnection::forceClose()
+{
+    if(state_ != kDisconnected)
+    {
+        if(stateAtomicGetAndSet(kDisconnecting) == kConnected)
+        {
+            loop_->queueInLoop(
+                std::bind(
+                    &TCPConnection::forceCloseInLoop,
+                    shared_from_this()
+                )
+            );
+        }
+    }
+}
+
+int TCPConnection::stateAtomicGetAndSet(int newState)
+{
+    return __atomic_exchange_n(&state_, newState, __ATOMIC_SEQ_CST);
+}
+
+void TCPConnection::stopRead()
+{
+    loop_->runInLoop(
+        [this]()
+        {
+            readStopped_ = true;
+            updateReadInterest();
+        }
+    );
+}
+
+void TCPConnection::startRead()
+{
+    loop_->runInLoop(
+        std::bind(
+            [this]()
+            {
+                readStopped_ = false;
+                updateReadInterest();
+            }
+        )
+    );
+}
+
+// read while neither stopRead() nor flow control says otherwise
+void TCPConnection::updateReadInterest()
+{
+    if(state_ == kConnecting || state_ == kDisconnected)
+        return;
+    bool wanted = !readStopped_ && readPauseCount_ == 0;
+    // held completion input goes first, the recv resumes after it
+    if(wanted && recvHeld_.readableBytes() > 0)
+    {
+        queueHeldInput();
+        return;
+    }
+    if(wanted && !channel_.isReading())
+        channel_.enableRead();
+    else if(!wanted && channel_.isReading())
+        channel_.dsiableRead();
+}
+
+void TCPConnection::setBackpressure(
+    size_t highWaterMark,
+    size_t lowWaterMark
+)
+{
+    loop_->assertInLoopThread();
+    assert(lowWaterMark <= highWaterMark);
+    backpressureHigh_ = highWaterMark;
+    backpressureLow_ = lowWaterMark;
+    updateBackpressure();
+}
+
+void TCPConnection::addBackpressureSource(const TCPConnectionPtr &source)
+{
+    loop_->assertInLoopThread();
+    backpressureSources_.push_back(source);
+    if(throttling_)
+    {
+        source->loop_->runInLoop(
+            [source]()
+            {
+                source->pauseReadInLoop();
+            }
+        );
+    }
+}
+
+Nanosecond TCPConnection::readPausedTime() const
+{
+    if(readPauseCount_ == 0)
+        return readPausedTime_;
+    return readPausedTime_ + (loop_->now() - readPausedSince_);
+}
+
+// hysteresis between the two marks, so reading is not toggled on
+// every write
+void TCPConnection::updateBackpressure()
+{
+    size_t queued = outputBytes();
+    bool over = backpressureHigh_ > 0 && queued >= backpressureHigh_;
+    bool under = backpressureHigh_ == 0 || queued <= backpressureLow_;
+    if(!throttling_ && over)
+    {
+        throttling_ = true;
+        pauseReadInLoop();
+        throttleSources(true);
+    }
+    else if(throttling_ && under)
+    {
+        throttling_ = false;
+        resumeReadInLoop();
+        throttleSources(false);
+    }
+}
+
+void TCPConnection::throttleSources(bool pause)
+{
+    for (auto &weak: backpressureSources_)
+    {
+        TCPConnectionPtr source = weak.lock();
+        if(!source)
+            continue;
+        source->loop_->runInLoop(
+            [source, pause]()
+            {
+                if(pause)
+                    source->pauseReadInLoop();
+                else
+                    source->resumeReadInLoop();
+            }
+        );
+    }
+}
+
+void TCPConnection::pauseReadInLoop()
+{
+    loop_->assertInLoopThread();
+    if(readPauseCount_++ == 0)
+    {
+        readPausedSince_ = loop_->now();
+        ++readPauses_;
+        updateReadInterest();
+    }
+}
+
+void TCPConnection::resumeReadInLoop()
+{
+    loop_->assertInLoopThread();
+    assert(readPauseCount_ > 0);
+    if(--readPauseCount_ == 0)
+    {
+        readPausedTime_ += loop_->now() - readPausedSince_;
+        updateReadInterest();
+    }
+}
+
+void TCPConnection::setEdgeTriggered(bool on)
+{
+    loop_->assertInLoopThread();
+    edgeTriggered_ = on;
+    channel_.setEdgeTriggered(on);
+}
+
+void TCPConnection::setReadBudget(size_t bytes, int reads)
+{
+    loop_->assertInLoopThread();
+    assert(bytes > 0 && reads > 0);
+    readBudget_ = bytes;
+    readBudgetReads_ = reads;
+}
+
+bool TCPConnection::setZeroCopy(bool on, size_t threshold)
+{
+    loop_->assertInLoopThread();
+    int opt = on ? 1: 0;
+    int ret = ::setsockopt(
+        sockfd_, SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt)
+    );
+    if(ret == -1)
+    {
+        SYSERR("TCPConnection::setsockopt SO_ZEROCOPY");
+        zeroCopy_ = false;
+        return false;
+    }
+    zeroCopy_ = on;
+    zeroCopyThreshold_ = threshold;
+    return true;
+}
+
+void TCPConnection::setChainedBuffers(bool on)
+{
+    loop_->assertInLoopThread();
+    assert(inputBuffer_.readableBytes() == 0);
+    assert(inputChain_.readableBytes() == 0);
+    assert(outputBytes() == 0);
+    chained_ = on;
+}
+
+ssize_t TCPConnection::readInput(int *savedErrno, size_t maxBytes)
+{
+    char *spill = loop_->spillBuffer();
+    size_t spillSize = EventLoop::kSpillBufferSize;
+    if(chained_)
+        return inputChain_.readFD(
+            sockfd_, savedErrno, spill, spillSize, maxBytes
+        );
+    return inputBuffer_.readFD(
+        sockfd_, savedErrno, spill, spillSize, maxBytes
+    );
+}
+
+void TCPConnection::deliverInput()
+{
+    if(chained_)
+    {
+        chainMessageCallback_(shared_from_this(), inputChain_);
+        inputChain_.release();
+    }
+    else
+    {
+        messageCallback_(shared_from_this(), inputBuffer_);
+        inputBuffer_.release();
+    }
+}
+
+size_t TCPConnection::outputBytes() const
+{
+    size_t buffered = chained_ ? outputChain_.readableBytes():
+        outputBuffer_.readableBytes();
+    return buffered + queuedBytes_;
+}
+
+void TCPConnection::appendOutput(const char *data, size_t len)
+{
+    if(!outputQueue_.empty())
+    {
+        outputQueue_.emplace_back(Slice(data, len));
+        queuedBytes_ += len;
+    }
+    else if(chained_)
+    {
+        outputChain_.append(data, len);
+    }
+    else
+    {
+        outputBuffer_.append(data, len);
+    }
+}
+
+ssize_t TCPConnection::writeOutput()
+{
+    if(!outputQueue_.empty())
+        return writeOutputQueue();
+
+    ssize_t n;
+    if(chained_)
+    {
+        struct iovec iov[IOV_MAX];
+        int iovcnt = outputChain_.peekSegments(iov, IOV_MAX);
+        n = ::writev(sockfd_, iov, iovcnt);
+        if(n > 0)
+            outputChain_.retrieve(static_cast<size_t>(n));
+    }
+    else
+    {
+        n = ::write(
+            sockfd_, outputBuffer_.peek(), outputBuffer_.readableBytes()
+        );
+        if(n > 0)
+            outputBuffer_.retrieve(static_cast<size_t>(n));
+    }
+    return n;
+}
+
+// Write until the socket takes less than offered. Returns the bytes
+// written, or what the first failing call returned.
+ssize_t TCPConnection::writeOutputQueue()
+{
+    ssize_t total = 0;
+    while (outputBytes() > 0)
+    {
+        size_t buffered = chained_ ? outputChain_.readableBytes():
+            outputBuffer_.readableBytes();
+        size_t wanted = 0;
+        ssize_t n;
+        if(buffered == 0 && outputQueue_.front().fd != -1)
+            n = writeOutputFile(&wanted);
+        else if(buffered == 0 && zeroCopyFront())
+            n = writeOutputZeroCopy(&wanted);
+        else
+            n = writeOutputVectors(&wanted);
+        if(n == 0 && wanted == 0)
+            continue;
+        if(n <= 0)
+            return total > 0 ? total: n;
+        total += n;
+        if(static_cast<size_t>(n) < wanted)
+            break;
+    }
+    return total;
+}
+
+// the buffered output first, then the segments up to the first file
+// region or zero-copy Slice, as many as one writev takes
+ssize_t TCPConnection::writeOutputVectors(size_t *wanted)
+{
+    const int kMaxIov = IOV_MAX;
+    struct iovec iov[kMaxIov];
+    int iovcnt;
+    if(chained_)
+    {
+        iovcnt = outputChain_.peekSegments(iov, kMaxIov);
+    }
+    else
+    {
+        iovcnt = 0;
+        if(outputBuffer_.readableBytes() > 0)
+        {
+            iov[0].iov_base = const_cast<char*>(outputBuffer_.peek());
+            iov[0].iov_len = outputBuffer_.readableBytes();
+            iovcnt = 1;
+        }
+    }
+    for (auto it = outputQueue_.begin();
+         it != outputQueue_.end() && it->fd == -1 && iovcnt < kMaxIov;
+         ++it)
+    {
+        if(zeroCopy_ && it->data.size() >= zeroCopyThreshold_)
+            break;
+        iov[iovcnt].iov_base = const_cast<char*>(it->data.data());
+        iov[iovcnt].iov_len = it->data.size();
+        ++iovcnt;
+    }
+    for (int i = 0; i < iovcnt; i++)
+        *wanted += iov[i].iov_len;
+
+    ssize_t n = ::writev(sockfd_, iov, iovcnt);
+    if(n <= 0)
+        return n;
+
+    size_t left = static_cast<size_t>(n);
+    size_t buffered = chained_ ? outputChain_.readableBytes():
+        outputBuffer_.readableBytes();
+    size_t chunk = std::min(left, buffered);
+    if(chained_)
+        outputChain_.retrieve(chunk);
+    else
+        outputBuffer_.retrieve(chunk);
+    left -= chunk;
+    while (left > 0)
+    {
+        Slice &front = outputQueue_.front().data;
+        if(left < front.size())
+        {
+            front.removePrefix(left);
+            queuedBytes_ -= left;
+            break;
+        }
+        left -= front.size();
+        popOutputSegment();
+    }
+    return n;
+}
+
+ssize_t TCPConnection::writeOutputFile(size_t *wanted)
+{
+    // sendfile() and splice() move at most this much per call
+    const size_t kMaxChunk = 0x7ffff000;
+    OutputSegment &front = outputQueue_.front();
+    *wanted = std::min(front.fileBytes, kMaxChunk);
+
+    ssize_t n;
+    if(front.pipe)
+        n = ::splice(
+            front.fd, nullptr, sockfd_, nullptr, *wanted,
+            SPLICE_F_MOVE | SPLICE_F_NONBLOCK
+        );
+    else
+        n = ::sendfile(sockfd_, front.fd, &front.offset, *wanted);
+
+    if(n == 0)
+    {
+        // the file is shorter than queued, or the pipe was closed
+        WARN(
+            "TCPConnection::writeOutputFile() fd=%d ended %lu bytes early.",
+            front.fd,
+            front.fileBytes
+        );
+        // nothing more to expect from this region
+        popOutputSegment();
+        *wanted = 0;
+        return 0;
+    }
+    if(n < 0)
+    {
+        // EAGAIN from either end: waiting for a writable socket would
+        // spin while the pipe stays empty
+        int avail;
+        if(front.pipe && errno == EAGAIN &&
+           ::ioctl(front.fd, FIONREAD, &avail) == 0 && avail == 0)
+        {
+            waitForPipe(front.fd);
+            errno = EAGAIN;
+        }
+        return n;
+    }
+
+    front.fileBytes -= static_cast<size_t>(n);
+    queuedBytes_ -= static_cast<size_t>(n);
+    if(front.fileBytes == 0)
+        popOutputSegment();
+    return n;
+}
+
+bool TCPConnection::zeroCopyFront() const
+{
+    const OutputSegment &front = outputQueue_.front();
+    return zeroCopy_ && front.fd == -1 &&
+        front.data.size() >= zeroCopyThreshold_;
+}
+
+ssize_t TCPConnection::writeOutputZeroCopy(size_t *wanted)
+{
+    Slice &front = outputQueue_.front().data;
+    *wanted = front.size();
+
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(front.data());
+    iov.iov_len = front.size();
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    ssize_t n = ::sendmsg(sockfd_, &msg, MSG_ZEROCOPY);
+    if(n == -1 && errno == ENOBUFS)
+    {
+        // out of optmem for pinning pages, copy this one
+        n = ::write(sockfd_, front.data(), front.size());
+        if(n > 0)
+        {
+            front.removePrefix(static_cast<size_t>(n));
+            queuedBytes_ -= static_cast<size_t>(n);
+            if(front.empty())
+                popOutputSegment();
+        }
+        return n;
+    }
+    if(n <= 0)
+        return n;
+
+    // the kernel numbers every MSG_ZEROCOPY send that queued data
+    Slice sent = front.subslice(0, static_cast<size_t>(n));
+    zeroCopyInFlight_.push_back({zeroCopyNextId_++, false, std::move(sent)});
+    // completions come through the error queue, which is not watched
+    // when nothing is read through readiness
+    if(!channel_.isErrorEnabled())
+        channel_.enableError();
+    front.removePrefix(static_cast<size_t>(n));
+    queuedBytes_ -= static_cast<size_t>(n);
+    if(front.empty())
+        popOutputSegment();
+    return n;
+}
+
+void TCPConnection::readZeroCopyCompletions()
+{
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+    for (;;)
+    {
+        struct msghdr msg = {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if(::recvmsg(sockfd_, &msg, MSG_ERRQUEUE) == -1)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK)
+                SYSERR("TCPConnection::recvmsg() MSG_ERRQUEUE");
+            return;
+        }
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr;
+             cm = CMSG_NXTHDR(&msg, cm))
+        {
+            bool recverr =
+                (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+            if(!recverr)
+                continue;
+            auto err = reinterpret_cast<struct sock_extended_err*>(
+                CMSG_DATA(cm)
+            );
+            if(err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            completeZeroCopy(
+                err->ee_info, err->ee_data,
+                err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED
+            );
+        }
+    }
+}
+
+// sends first..last are done with, usually the oldest ones
+void TCPConnection::completeZeroCopy(
+    uint32_t first,
+    uint32_t last,
+    bool copied
+)
+{
+    uint32_t count = last - first + 1;
+    zeroCopyCompleted_ += count;
+    if(copied)
+        zeroCopyCopied_ += count;
+    for (auto &send: zeroCopyInFlight_)
+    {
+        // ids wrap around
+        if(send.id - first < count)
+            send.done = true;
+    }
+    while (!zeroCopyInFlight_.empty() && zeroCopyInFlight_.front().done)
+        zeroCopyInFlight_.pop_front();
+    if(zeroCopyInFlight_.empty() && state_ != kDisconnected &&
+       channel_.isErrorEnabled())
+        channel_.disableError();
+}
+
+void TCPConnection::waitForPipe(int fd)
+{
+    if(pipeChannel_ == nullptr || pipeChannel_->fd() != fd)
+    {
+        pipeChannel_.reset(new Channel(loop_, fd));
+        pipeChannel_->tie(shared_from_this());
+        pipeChannel_->setReadCallback([this](){handlePipeReadable();});
+        // the writer went away, splice() reports the early end
+        pipeChannel_->setCloseCallback([this](){handlePipeReadable();});
+    }
+    pipeChannel_->enableRead();
+}
+
+void TCPConnection::handlePipeReadable()
+{
+    // kept until its segment is done, it may be waited on again
+    pipeChannel_->disableAll();
+    if(state_ != kDisconnected && !channel_.isWriting())
+        channel_.enableWrite();
+}
+
+void TCPConnection::popOutputSegment()
+{
+    OutputSegment &front = outputQueue_.front();
+    queuedBytes_ -= front.size();
+    if(pipeChannel_ != nullptr && pipeChannel_->fd() == front.fd)
+        pipeChannel_.reset();
+    if(front.fd != -1)
+        ::close(front.fd);
+    outputQueue_.pop_front();
+}
+
+void TCPConnection::handleRead()
+{
+    loop_->assertInLoopThread();
+    assert(state_ != kDisconnected);
+    if(edgeTriggered_)
+    {
+        handleReadEdgeTriggered();
+        return;
+    }
+
+    int savedErrno;
+    ssize_t n = readInput(&savedErrno, readBudget_);
+    if(n == -1)
+    {
+        errno = savedErrno;
+        SYSERR("TCPConnection::read()");
+        handleError();
+    }
+    else if(n == 0)
+    {
+        handleClose();
+    }
+    else
+    {
+        if(static_cast<size_t>(n) == readBudget_)
+            ++readBudgetExhausted_;
+        deliverInput();
+    }
+}
+
+void TCPConnection::handleReadEdgeTriggered()
+{
+    size_t total = 0;
+    int reads = 0;
+    int savedErrno = 0;
+    ssize_t n = 0;
+    while (total < readBudget_ && reads < readBudgetReads_)
+    {
+        n = readInput(&savedErrno, readBudget_ - total);
+        if(n <= 0)
+            break;
+        total += static_cast<size_t>(n);
+        ++reads;
+    }
+
+    if(total > 0)
+        deliverInput();
+
+    if(n == 0)
+    {
+        if(state_ != kDisconnected)
+            handleClose();
+    }
+    else if(n == -1)
+    {
+        if(savedErrno != EAGAIN && savedErrno != EWOULDBLOCK)
+        {
+            errno = savedErrno;
+            SYSERR("TCPConnection::read()");
+            handleError();
+        }
+    }
+    else
+    {
+        // budget used up and the socket will not be reported again,
+        // go on after the others had their turn
+        ++readBudgetExhausted_;
+        if(readRequeued_)
+            return;
+        readRequeued_ = true;
+        loop_->queueNextIteration(
+            [ptr = shared_from_this()]()
+            {
+                ptr->readRequeued_ = false;
+                if(ptr->state_ != kDisconnected && ptr->channel_.isReading())
+                    ptr->handleRead();
+            }
+        );
+    }
+}
+
+// Budget used up by completions: stop the recv and go on after the
+// others had their turn. What it took off the socket before the cancel
+// landed is held, and handed over a budget per iteration.
+void TCPConnection::pauseRecvForBudget()
+{
+    ++readBudgetExhausted_;
+    if(channel_.isReading())
+        channel_.dsiableRead();
+    queueHeldInput();
+}
+
+void TCPConnection::queueHeldInput()
+{
+    if(readRequeued_)
+        return;
+    readRequeued_ = true;
+    loop_->queueNextIteration(
+        [ptr = shared_from_this()]()
+        {
+            ptr->deliverHeldInput();
+        }
+    );
+}
+
+void TCPConnection::takeHeldInput(size_t len)
+{
+    size_t left = len;
+    recvHeld_.forEachSegment(
+        [this, &left](const char *data, size_t n)
+        {
+            n = std::min(n, left);
+            if(chained_)
+                inputChain_.append(data, n);
+            else
+                inputBuffer_.append(data, n);
+            left -= n;
+        }
+    );
+    recvHeld_.retrieve(len);
+}
+
+void TCPConnection::deliverHeldInput()
+{
+    readRequeued_ = false;
+    // stopped or paused, updateReadInterest() goes on when it resumes
+    if(state_ == kDisconnected || readStopped_ || readPauseCount_ > 0)
+        return;
+    size_t len = std::min(readBudget_, recvHeld_.readableBytes());
+    if(len > 0)
+    {
+        takeHeldInput(len);
+        deliverInput();
+        if(state_ == kDisconnected)
+            return;
+    }
+    if(recvHeld_.readableBytes() > 0)
+    {
+        pauseRecvForBudget();
+        return;
+    }
+    recvHeld_.release();
+    updateReadInterest();
+}
+
+// The poller received into one of its buffers, which is only lent
+// for this call.
+void TCPConnection::handleRecvCompletion(int res, const char *data)
+{
+    loop_->assertInLoopThread();
+    // what was received before the connection closed is dropped
+    if(state_ == kDisconnected)
+        return;
+    if(res > 0)
+    {
+        if(recvIteration_ != loop_->iteration())
+        {
+            recvIteration_ = loop_->iteration();
+            recvTaken_ = 0;
+        }
+        // over budget, or behind input that was
+        if(recvTaken_ >= readBudget_ || recvHeld_.readableBytes() > 0)
+        {
+            recvHeld_.append(data, static_cast<size_t>(res));
+            return;
+        }
+
+        if(chained_)
+            inputChain_.append(data, static_cast<size_t>(res));
+        else
+            inputBuffer_.append(data, static_cast<size_t>(res));
+        recvTaken_ += static_cast<size_t>(res);
+        deliverInput();
+        if(recvTaken_ >= readBudget_ && state_ != kDisconnected)
+            pauseRecvForBudget();
+        return;
+    }
+
+    // the stream ends here, held input is handed over first
+    if(recvHeld_.readableBytes() > 0)
+    {
+        takeHeldInput(recvHeld_.readableBytes());
+        deliverInput();
+        if(state_ == kDisconnected)
+            return;
+    }
+    if(res == 0)
+    {
+        handleClose();
+    }
+    else
+    {
+        // the multishot recv is over, nothing reads the socket again
+        errno = -res;
+        SYSERR("TCPConnection::recv()");
+        handleError();
+        handleClose();
+    }
+}
+
+void TCPConnection::handleWrite()
+{
+    if(state_ == kDisconnected)
+    {
+        WARN(
+            "TCPConnection::handleWrite() dsiconnected,"
+            "give up write %lu bytes.",
+            outputBytes()
+        );
+        return;
+    }
+
+    assert(outputBytes() > 0);
+    assert(channel_.isWriting());
+    ssize_t n = 0;
+    do
+    {
+        n = writeOutput();
+    } while (edgeTriggered_ && n > 0 && outputBytes() > 0);
+    updateBackpressure();
+    if(waitingForPipe())
+    {
+        // the socket is not what the output waits for
+        channel_.disableWrite();
+        return;
+    }
+    if(outputBytes() == 0)
+    {
+        outputBuffer_.release();
+        outputChain_.release();
+    }
+
+    if(n == -1)
+    {
+        if(errno != EAGAIN)
+            SYSERR("TCPConnection::write()");
     }
     else
     {
-        outputBuffer_.retrieve(static_cast<size_t>(n));
-        if(outputBuffer_.readableBytes() == 0)
+        if(outputBytes() == 0)
         {
             channel_.disableWrite();
             if(state_ == kDisconnecting)
@@ -375,14 +1582,39 @@ void TCPConnection::handleClose()
     assert(state_ == kConnected || state_ == kDisconnecting);
     state_ = kDisconnected;
     loop_->removeChannel(&channel_);
+    // nothing will be read or written any more
+    inputBuffer_.retrieveAll();
+    inputBuffer_.release();
+    outputBuffer_.retrieveAll();
+    outputBuffer_.release();
+    inputChain_.retrieveAll();
+    inputChain_.release();
+    outputChain_.retrieveAll();
+    outputChain_.release();
+    while (!outputQueue_.empty())
+        popOutputSegment();
+    // zeroCopyInFlight_ stays: no completion comes after the socket is
+    // gone, but the kernel may still hold the pages
+    if(throttling_)
+    {
+        throttling_ = false;
+        throttleSources(false);
+    }
     closeCallback_(shared_from_this());
 }
 
 void TCPConnection::handleError()
 {
+    // zero-copy completions are reported as errors too
+    bool zeroCopy = zeroCopy_ || !zeroCopyInFlight_.empty();
+    if(zeroCopy)
+        readZeroCopyCompletions();
+
     int err;
     socklen_t len = sizeof(err);
     int ret = getsockopt(sockfd_, SOL_SOCKET, SO_ERROR, &err, &len);
+    if(zeroCopy && ret != -1 && err == 0)
+        return;
     if(ret != -1)
         errno = err;
     SYSERR("TCPConnection::handleError()");
@@ -68,6 +68,14 @@ void Acceptor::listen()
             handleRead();
         }
     );
+    if(loop_->completionIO())
+        acceptChannel_.setCompletion(
+            Channel::CompletionOp::kAccept,
+            [this](int res, const char*)
+            {
+                handleAcceptCompletion(res);
+            }
+        );
     acceptChannel_.enableRead();
 }
 
@@ -87,17 +95,53 @@ void Acceptor::handleRead()
 
     if (sockfd == -1)
     {
-        int savedErrno = errno;
-        SYSERR("Acceptor::accept4");
-        switch (savedErrno) {
-            case ECONNABORTED:
-            case EMFILE:
-                break;
-            default:
-                FATAL("Unexpected accept4 error.");
-        }
+        acceptFailed(errno);
+        return;
+    }
+    newConnection(sockfd, addr);
+}
+
+
+// the poller accepted already, it cannot ask for the peer address
+void Acceptor::handleAcceptCompletion(int sockfd)
+{
+    loop_->assertInLoopThread();
+    if (sockfd < 0)
+    {
+        acceptFailed(-sockfd);
+        return;
     }
 
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    void *any = &addr;
+    if (::getpeername(sockfd, static_cast<sockaddr*>(any), &len) == -1)
+    {
+        // reset before we got to it
+        SYSERR("Acceptor::getpeername");
+        ::close(sockfd);
+        return;
+    }
+    newConnection(sockfd, addr);
+}
+
+
+void Acceptor::acceptFailed(int savedErrno)
+{
+    errno = savedErrno;
+    SYSERR("Acceptor::accept4");
+    switch (savedErrno) {
+        case ECONNABORTED:
+        case EMFILE:
+            break;
+        default:
+            FATAL("Unexpected accept4 error.");
+    }
+}
+
+
+void Acceptor::newConnection(int sockfd, const struct sockaddr_in &addr)
+{
     if (newConnectionCallback_)
     {
         InetAddress peer;
@@ -7,25 +7,43 @@ namespace eloop
 {
 
 const char Buffer::kCRLF[] = "\r\n";
+char Buffer::kEmpty[Buffer::kCheapPrepend];
 
 
 ssize_t Buffer::readFD(int fd, int *savedErrno)
 {
     char extra_buffer[65536];
+    return readFD(fd, savedErrno, extra_buffer, sizeof(extra_buffer));
+}
+
+ssize_t Buffer::readFD(
+    int fd,
+    int *savedErrno,
+    char *spill,
+    size_t spillSize,
+    size_t maxBytes
+)
+{
+    if(data_ == nullptr)
+        reserve(std::max(readHint_, initialSize_) + kCheapPrepend);
+    else if(readHint_ > writableBytes())
+        ensureWritableBytes(readHint_);
+
     struct iovec vec[2];
-    const size_t writable = writableBytes();
+    const size_t writable = std::min(writableBytes(), maxBytes);
 
     vec[0].iov_base = begin() + writerIndex_;
     vec[0].iov_len = writable;
-    vec[1].iov_base = extra_buffer;
-    vec[1].iov_len = sizeof(extra_buffer);
+    vec[1].iov_base = spill;
+    vec[1].iov_len = std::min(spillSize, maxBytes - writable);
 
-    const int iovcnt = (writable < sizeof(extra_buffer)) ? 2: 1;
+    const int iovcnt = (writable < spillSize && vec[1].iov_len > 0) ? 2: 1;
     const ssize_t n = readv(fd, vec, iovcnt);
 
     if(n < 0)
     {
         *savedErrno  = errno;
+        return n;
     }
     else if (static_cast<size_t>(n) <= writable)
     {
@@ -35,10 +53,15 @@ ssize_t Buffer::readFD(int fd, int *savedErrno)
     else
     {
         // only iov[0] and iov[1]
-        writerIndex_ = buffer_.size();
-        append(extra_buffer, n - writable);
+        writerIndex_ += writable;
+        append(spill, n - writable);
     }
 
+    size_t len = static_cast<size_t>(n);
+    if(len >= readHint_)
+        readHint_ = len;
+    else
+        readHint_ -= (readHint_ - len) / 4;
     return n;
 }
 
@@ -0,0 +1,110 @@
+#include <cassert>
+#include <new>
+#include "eloop/bufferPool.hpp"
+
+
+namespace eloop
+{
+
+BufferPool::BufferPool(size_t maxCachedBytes)
+    : maxCachedPerClass_(maxCachedBytes / kNumClasses),
+      bytesInUse_(0),
+      bytesCached_(0)
+{
+    static_assert(
+        kMinClass << (kNumClasses - 1) == kMaxClass,
+        "size classes must span kMinClass..kMaxClass"
+    );
+}
+
+BufferPool::~BufferPool()
+{
+    for (auto &list: free_)
+    {
+        for (auto data: list)
+            ::operator delete(data);
+    }
+}
+
+int BufferPool::classOf(size_t capacity)
+{
+    int c = 0;
+    size_t size = kMinClass;
+    while (size < capacity)
+    {
+        size <<= 1;
+        ++c;
+    }
+    return c;
+}
+
+char *BufferPool::allocate(size_t &capacity)
+{
+    if(capacity > kMaxClass)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        bytesInUse_ += capacity;
+        return static_cast<char*>(::operator new(capacity));
+    }
+
+    int c = classOf(capacity);
+    capacity = kMinClass << c;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        bytesInUse_ += capacity;
+        if(!free_[c].empty())
+        {
+            char *data = free_[c].back();
+            free_[c].pop_back();
+            bytesCached_ -= capacity;
+            return data;
+        }
+    }
+    return static_cast<char*>(::operator new(capacity));
+}
+
+void BufferPool::deallocate(char *data, size_t capacity)
+{
+    if(data == nullptr)
+        return;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        // buffers give storage back to the pool it came from
+        assert(capacity <= bytesInUse_);
+        bytesInUse_ -= capacity;
+        if(capacity <= kMaxClass)
+        {
+            int c = classOf(capacity);
+            // only exact class sizes can be handed out again
+            if(capacity == (kMinClass << c) &&
+               (free_[c].size() + 1) * capacity <= maxCachedPerClass_)
+            {
+                free_[c].push_back(data);
+                bytesCached_ += capacity;
+                return;
+            }
+        }
+    }
+    ::operator delete(data);
+}
+
+void BufferPool::detach(size_t capacity)
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    assert(capacity <= bytesInUse_);
+    bytesInUse_ -= capacity;
+}
+
+size_t BufferPool::bytesInUse() const
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    return bytesInUse_;
+}
+
+size_t BufferPool::bytesCached() const
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    return bytesCached_;
+}
+
+}
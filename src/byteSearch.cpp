@@ -0,0 +1,270 @@
+#include <cstdint>
+#include <cstring>
+#include "eloop/byteSearch.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ELOOP_X86 1
+#endif
+
+
+namespace
+{
+
+using FindAnyOf = const char *(*)(
+    const char*, const char*, const char*, size_t
+);
+using FindNeedle = const char *(*)(
+    const char*, const char*, const char*, size_t
+);
+
+// sets larger than this use the lookup table
+const size_t kMaxVectorSet = 16;
+
+const char *findAnyOfScalar(
+    const char *begin, const char *end,
+    const char *set, size_t setSize
+)
+{
+    bool table[256] = {false};
+    for (size_t i = 0; i < setSize; i++)
+        table[static_cast<unsigned char>(set[i])] = true;
+    for (const char *p = begin; p < end; ++p)
+    {
+        if(table[static_cast<unsigned char>(*p)])
+            return p;
+    }
+    return end;
+}
+
+const char *findScalar(
+    const char *begin, const char *end,
+    const char *needle, size_t needleSize
+)
+{
+    // memchr for the first byte, memcmp for the rest
+    if(static_cast<size_t>(end - begin) < needleSize)
+        return end;
+    const char *last = end - needleSize;
+    const char *p = begin;
+    while (p <= last)
+    {
+        const void *hit = memchr(p, needle[0], last - p + 1);
+        if(hit == nullptr)
+            return end;
+        p = static_cast<const char*>(hit);
+        if(memcmp(p + 1, needle + 1, needleSize - 1) == 0)
+            return p;
+        ++p;
+    }
+    return end;
+}
+
+#ifdef ELOOP_X86
+
+const char *findAnyOfSSE2(
+    const char *begin, const char *end,
+    const char *set, size_t setSize
+)
+{
+    if(setSize > kMaxVectorSet)
+        return findAnyOfScalar(begin, end, set, setSize);
+
+    __m128i wanted[kMaxVectorSet];
+    for (size_t i = 0; i < setSize; i++)
+        wanted[i] = _mm_set1_epi8(set[i]);
+
+    const char *p = begin;
+    for (; p + 16 <= end; p += 16)
+    {
+        __m128i block = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(p)
+        );
+        __m128i hits = _mm_setzero_si128();
+        for (size_t i = 0; i < setSize; i++)
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, wanted[i]));
+        int mask = _mm_movemask_epi8(hits);
+        if(mask != 0)
+            return p + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+    return findAnyOfScalar(p, end, set, setSize);
+}
+
+__attribute__((target("avx2")))
+const char *findAnyOfAVX2(
+    const char *begin, const char *end,
+    const char *set, size_t setSize
+)
+{
+    if(setSize > kMaxVectorSet)
+        return findAnyOfScalar(begin, end, set, setSize);
+
+    __m256i wanted[kMaxVectorSet];
+    for (size_t i = 0; i < setSize; i++)
+        wanted[i] = _mm256_set1_epi8(set[i]);
+
+    const char *p = begin;
+    for (; p + 32 <= end; p += 32)
+    {
+        __m256i block = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(p)
+        );
+        __m256i hits = _mm256_setzero_si256();
+        for (size_t i = 0; i < setSize; i++)
+            hits = _mm256_or_si256(
+                hits, _mm256_cmpeq_epi8(block, wanted[i])
+            );
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hits));
+        if(mask != 0)
+            return p + __builtin_ctz(mask);
+    }
+    return findAnyOfSSE2(p, end, set, setSize);
+}
+
+// Compare the first and the last needle byte at every position of a
+// block at once, memcmp only where both match.
+const char *findSSE2(
+    const char *begin, const char *end,
+    const char *needle, size_t needleSize
+)
+{
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needleSize - 1]);
+
+    const char *p = begin;
+    for (; p + needleSize - 1 + 16 <= end; p += 16)
+    {
+        __m128i blockFirst = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(p)
+        );
+        __m128i blockLast = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(p + needleSize - 1)
+        );
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_and_si128(
+                _mm_cmpeq_epi8(blockFirst, first),
+                _mm_cmpeq_epi8(blockLast, last)
+            )
+        ));
+        while (mask != 0)
+        {
+            int i = __builtin_ctz(mask);
+            if(memcmp(p + i + 1, needle + 1, needleSize - 2) == 0)
+                return p + i;
+            mask &= mask - 1;
+        }
+    }
+    return findScalar(p, end, needle, needleSize);
+}
+
+__attribute__((target("avx2")))
+const char *findAVX2(
+    const char *begin, const char *end,
+    const char *needle, size_t needleSize
+)
+{
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needleSize - 1]);
+
+    const char *p = begin;
+    for (; p + needleSize - 1 + 32 <= end; p += 32)
+    {
+        __m256i blockFirst = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(p)
+        );
+        __m256i blockLast = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(p + needleSize - 1)
+        );
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_and_si256(
+                _mm256_cmpeq_epi8(blockFirst, first),
+                _mm256_cmpeq_epi8(blockLast, last)
+            )
+        ));
+        while (mask != 0)
+        {
+            int i = __builtin_ctz(mask);
+            if(memcmp(p + i + 1, needle + 1, needleSize - 2) == 0)
+                return p + i;
+            mask &= mask - 1;
+        }
+    }
+    return findSSE2(p, end, needle, needleSize);
+}
+
+#endif
+
+struct Implementation
+{
+    const char *name;
+    FindAnyOf findAnyOf;
+    FindNeedle find;
+};
+
+Implementation select()
+{
+#ifdef ELOOP_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return {"avx2", findAnyOfAVX2, findAVX2};
+    if(__builtin_cpu_supports("sse2"))
+        return {"sse2", findAnyOfSSE2, findSSE2};
+#endif
+    return {"scalar", findAnyOfScalar, findScalar};
+}
+
+const Implementation &impl()
+{
+    static const Implementation selected = select();
+    return selected;
+}
+
+}
+
+namespace eloop
+{
+
+namespace bytes
+{
+
+const char *find(const char *begin, const char *end, char c)
+{
+    // glibc's memchr is vectorized and dispatched already
+    const void *hit = memchr(begin, c, end - begin);
+    return hit == nullptr ? end: static_cast<const char*>(hit);
+}
+
+const char *findAnyOf(
+    const char *begin, const char *end,
+    const char *set, size_t setSize
+)
+{
+    if(setSize == 0)
+        return end;
+    if(setSize == 1)
+        return find(begin, end, set[0]);
+    return impl().findAnyOf(begin, end, set, setSize);
+}
+
+const char *find(
+    const char *begin, const char *end,
+    const char *needle, size_t needleSize
+)
+{
+    if(needleSize == 0)
+        return begin;
+    if(static_cast<size_t>(end - begin) < needleSize)
+        return end;
+    if(needleSize == 1)
+        return find(begin, end, needle[0]);
+    return impl().find(begin, end, needle, needleSize);
+}
+
+const char *implementation()
+{
+    return impl().name;
+}
+
+}
+
+}
@@ -0,0 +1,407 @@
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <algorithm>
+#include "eloop/chainBuffer.hpp"
+
+
+namespace eloop
+{
+
+ChainBuffer::ChainBuffer(BufferPool *pool)
+    : head_(nullptr),
+      tail_(nullptr),
+      readable_(0),
+      spare_(nullptr),
+      readHint_(0),
+      pool_(pool)
+{}
+
+// the blocks move, other keeps its pool for what it allocates next
+ChainBuffer::ChainBuffer(ChainBuffer &&other) noexcept
+    : ChainBuffer(other.pool_)
+{
+    swap(other);
+}
+
+ChainBuffer &ChainBuffer::operator=(ChainBuffer &&other) noexcept
+{
+    if(this != &other)
+    {
+        ChainBuffer tmp(std::move(other));
+        swap(tmp);
+    }
+    return *this;
+}
+
+ChainBuffer::~ChainBuffer()
+{
+    while (head_ != nullptr)
+    {
+        Block *next = head_->next;
+        deleteBlock(head_);
+        head_ = next;
+    }
+    if(spare_ != nullptr)
+        deleteBlock(spare_);
+}
+
+void ChainBuffer::release()
+{
+    if(readable_ != 0)
+        return;
+    while (head_ != nullptr)
+    {
+        Block *next = head_->next;
+        deleteBlock(head_);
+        head_ = next;
+    }
+    tail_ = nullptr;
+    if(spare_ != nullptr)
+    {
+        deleteBlock(spare_);
+        spare_ = nullptr;
+    }
+    // an idle buffer starts small again
+    readHint_ = 0;
+}
+
+void ChainBuffer::detachPool()
+{
+    for (Block *block = head_; block != nullptr; block = block->next)
+    {
+        if(block->pool != nullptr)
+            block->pool->detach(sizeof(Block) + block->capacity);
+        block->pool = nullptr;
+    }
+    if(spare_ != nullptr)
+    {
+        if(spare_->pool != nullptr)
+            spare_->pool->detach(sizeof(Block) + spare_->capacity);
+        spare_->pool = nullptr;
+    }
+    pool_ = nullptr;
+}
+
+size_t ChainBuffer::capacity() const
+{
+    size_t bytes = 0;
+    for (Block *block = head_; block != nullptr; block = block->next)
+        bytes += sizeof(Block) + block->capacity;
+    if(spare_ != nullptr)
+        bytes += sizeof(Block) + spare_->capacity;
+    return bytes;
+}
+
+void ChainBuffer::swap(ChainBuffer &target)
+{
+    std::swap(head_, target.head_);
+    std::swap(tail_, target.tail_);
+    std::swap(readable_, target.readable_);
+    std::swap(spare_, target.spare_);
+    std::swap(readHint_, target.readHint_);
+}
+
+ChainBuffer::Block *ChainBuffer::newBlock(size_t capacity)
+{
+    size_t size = sizeof(Block) + capacity;
+    void *mem;
+    if(pool_ != nullptr)
+        mem = pool_->allocate(size);
+    else
+        mem = ::operator new(size);
+    Block *block = static_cast<Block*>(mem);
+    block->next = nullptr;
+    block->pool = pool_;
+    block->capacity = static_cast<uint32_t>(size - sizeof(Block));
+    block->read = 0;
+    block->write = 0;
+    return block;
+}
+
+void ChainBuffer::deleteBlock(Block *block)
+{
+    if(block->pool != nullptr)
+        block->pool->deallocate(
+            reinterpret_cast<char*>(block), sizeof(Block) + block->capacity
+        );
+    else
+        ::operator delete(block);
+}
+
+ChainBuffer::Block *ChainBuffer::takeBlock()
+{
+    if(spare_ == nullptr)
+        return newBlock(kBlockCapacity);
+    Block *block = spare_;
+    spare_ = nullptr;
+    return block;
+}
+
+void ChainBuffer::recycle(Block *block)
+{
+    // oversized blocks come from pullup(), do not keep them
+    if(spare_ == nullptr && block->capacity == kBlockCapacity)
+    {
+        block->next = nullptr;
+        block->read = 0;
+        block->write = 0;
+        spare_ = block;
+    }
+    else
+    {
+        deleteBlock(block);
+    }
+}
+
+void ChainBuffer::link(Block *block)
+{
+    block->next = nullptr;
+    if(tail_ == nullptr)
+        head_ = block;
+    else
+        tail_->next = block;
+    tail_ = block;
+}
+
+int ChainBuffer::peekSegments(struct iovec *iov, int maxIov) const
+{
+    int n = 0;
+    for (Block *block = head_; block != nullptr && n < maxIov;
+         block = block->next)
+    {
+        if(block->write == block->read)
+            continue;
+        iov[n].iov_base = block->data() + block->read;
+        iov[n].iov_len = block->write - block->read;
+        ++n;
+    }
+    return n;
+}
+
+const char *ChainBuffer::pullup(size_t len)
+{
+    assert(len <= readableBytes());
+    if(len <= contiguousBytes())
+        return peek();
+
+    // gather the prefix into one block, the only copy a ChainBuffer
+    // ever makes
+    Block *block = newBlock(std::max(len, kBlockCapacity));
+    size_t copied = 0;
+    while (copied < len)
+    {
+        size_t chunk = std::min(
+            len - copied,
+            static_cast<size_t>(head_->write - head_->read)
+        );
+        memcpy(block->data() + copied, head_->data() + head_->read, chunk);
+        copied += chunk;
+        head_->read += static_cast<uint32_t>(chunk);
+        if(head_->read == head_->write)
+        {
+            Block *drained = head_;
+            head_ = drained->next;
+            if(tail_ == drained)
+                tail_ = nullptr;
+            recycle(drained);
+        }
+    }
+    block->write = static_cast<uint32_t>(len);
+    block->next = head_;
+    head_ = block;
+    if(tail_ == nullptr)
+        tail_ = block;
+    return peek();
+}
+
+void ChainBuffer::retrieve(size_t len)
+{
+    assert(len <= readableBytes());
+    readable_ -= len;
+    while (len > 0)
+    {
+        size_t chunk = std::min(
+            len, static_cast<size_t>(head_->write - head_->read)
+        );
+        head_->read += static_cast<uint32_t>(chunk);
+        len -= chunk;
+        if(head_->read == head_->write && head_ != tail_)
+        {
+            Block *drained = head_;
+            head_ = drained->next;
+            recycle(drained);
+        }
+    }
+    // keep the last block, rewound, for the next append
+    if(readable_ == 0 && head_ != nullptr)
+    {
+        assert(head_ == tail_);
+        head_->read = 0;
+        head_->write = 0;
+    }
+}
+
+void ChainBuffer::retrieveAll()
+{
+    retrieve(readableBytes());
+}
+
+std::string ChainBuffer::retrieveAsString(size_t len)
+{
+    assert(len <= readableBytes());
+    std::string result;
+    result.reserve(len);
+    size_t left = len;
+    for (Block *block = head_; block != nullptr && left > 0;
+         block = block->next)
+    {
+        size_t chunk = std::min(
+            left, static_cast<size_t>(block->write - block->read)
+        );
+        result.append(block->data() + block->read, chunk);
+        left -= chunk;
+    }
+    retrieve(len);
+    return result;
+}
+
+void ChainBuffer::append(const char *data, size_t len)
+{
+    readable_ += len;
+    while (len > 0)
+    {
+        if(tailWritable() == 0)
+            link(takeBlock());
+        size_t chunk = std::min(len, tailWritable());
+        memcpy(tail_->data() + tail_->write, data, chunk);
+        tail_->write += static_cast<uint32_t>(chunk);
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+void ChainBuffer::append(ChainBuffer &&other)
+{
+    if(other.readable_ == 0)
+        return;
+    if(readable_ == 0 && head_ != nullptr)
+    {
+        // drop our rewound block rather than leave a hole
+        assert(head_ == tail_);
+        recycle(head_);
+        head_ = nullptr;
+        tail_ = nullptr;
+    }
+    if(tail_ == nullptr)
+        head_ = other.head_;
+    else
+        tail_->next = other.head_;
+    tail_ = other.tail_;
+    readable_ += other.readable_;
+    other.head_ = nullptr;
+    other.tail_ = nullptr;
+    other.readable_ = 0;
+}
+
+ssize_t ChainBuffer::readFD(int fd, int *savedErrno)
+{
+    char extra_buffer[65536];
+    return readFD(fd, savedErrno, extra_buffer, sizeof(extra_buffer));
+}
+
+ssize_t ChainBuffer::readFD(
+    int fd,
+    int *savedErrno,
+    char *spill,
+    size_t spillSize,
+    size_t maxBytes
+)
+{
+    // free space of the last block, then fresh blocks for what recent
+    // reads suggest is coming, then spill for whatever is left over
+    struct iovec vec[kMaxReadBlocks + 2];
+    Block *fresh[kMaxReadBlocks];
+    int iovcnt = 0;
+
+    const size_t writable = std::min(tailWritable(), maxBytes);
+    if(writable > 0)
+    {
+        vec[iovcnt].iov_base = tail_->data() + tail_->write;
+        vec[iovcnt].iov_len = writable;
+        ++iovcnt;
+    }
+    size_t wanted = std::min(readHint_, maxBytes);
+    wanted = wanted > writable ? wanted - writable: 0;
+    int numFresh = static_cast<int>(std::min(
+        (wanted + kBlockCapacity - 1) / kBlockCapacity,
+        static_cast<size_t>(kMaxReadBlocks)
+    ));
+    if(numFresh == 0)
+        numFresh = 1;
+    for (int i = 0; i < numFresh; i++)
+    {
+        fresh[i] = takeBlock();
+        vec[iovcnt].iov_base = fresh[i]->data();
+        vec[iovcnt].iov_len = fresh[i]->capacity;
+        ++iovcnt;
+    }
+    vec[iovcnt].iov_base = spill;
+    vec[iovcnt].iov_len = spillSize;
+    ++iovcnt;
+
+    // trim the tail of the vector down to maxBytes, what is left over
+    // stays in the socket
+    size_t offered = 0;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        vec[i].iov_len = std::min(vec[i].iov_len, maxBytes - offered);
+        offered += vec[i].iov_len;
+    }
+
+    const ssize_t n = ::readv(fd, vec, iovcnt);
+    if(n < 0)
+    {
+        *savedErrno = errno;
+        for (int i = 0; i < numFresh; i++)
+            recycle(fresh[i]);
+        return n;
+    }
+
+    size_t left = static_cast<size_t>(n);
+    size_t chunk = std::min(left, writable);
+    if(chunk > 0)
+    {
+        tail_->write += static_cast<uint32_t>(chunk);
+        readable_ += chunk;
+        left -= chunk;
+    }
+
+    for (int i = 0; i < numFresh; i++)
+    {
+        chunk = std::min(left, static_cast<size_t>(fresh[i]->capacity));
+        if(chunk > 0)
+        {
+            fresh[i]->write = static_cast<uint32_t>(chunk);
+            link(fresh[i]);
+            readable_ += chunk;
+            left -= chunk;
+        }
+        else
+        {
+            recycle(fresh[i]);
+        }
+    }
+
+    if(left > 0)
+        append(spill, left);
+
+    size_t len = static_cast<size_t>(n);
+    if(len >= readHint_)
+        readHint_ = len;
+    else
+        readHint_ -= (readHint_ - len) / 4;
+    return n;
+}
+
+}
@@ -8,17 +8,24 @@ namespace eloop
 
 Channel::Channel(EventLoop *loop, int fd)
     : polling(false),
+      pollingEvents(0),
+      dirty(false),
+      reported(false),
       loop_(loop),
       fd_(fd),
       tied_(false),
       events_(0),
       revents_(0),
-      handlingEvents_(false)
+      edgeTriggered_(false),
+      handlingEvents_(false),
+      completionOp_(CompletionOp::kNone)
 {}
 
 Channel::~Channel()
 {
     assert(!handlingEvents_);
+    if(polling || dirty)
+        loop_->removeChannel(this);
 }
 
 void Channel::handleEvents()
@@ -43,6 +50,15 @@ void Channel::handleEvents()
 void Channel::handleEventsWithGuard()
 {
     handlingEvents_ = true;
+    // handlers may close the fd, results already taken off the socket
+    // are handed over all the same
+    if(!completions_.empty())
+    {
+        handlingCompletions_.swap(completions_);
+        for (auto &completion: handlingCompletions_)
+            completionCallback_(completion.res, completion.data);
+        handlingCompletions_.clear();
+    }
     if((revents_ & EPOLLHUP) && !(revents_ & EPOLLIN))
     {
         if(closeCallback_)
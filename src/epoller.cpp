@@ -1,5 +1,10 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <ratio>
 #include <unistd.h>
 #include <sys/epoll.h>
+#include <sys/syscall.h>
 #include <cassert>
 #include "eloop/log.hpp"
 #include "eloop/eventLoop.hpp"
@@ -12,7 +17,14 @@ namespace eloop
 EPoller::EPoller(EventLoop *loop)
     : loop_(loop),
       events_(128),
-      epollfd_(::epoll_create1(EPOLL_CLOEXEC))
+      epollfd_(::epoll_create1(EPOLL_CLOEXEC)),
+      numUpdates_(0),
+      numEpollCtl_(0),
+#ifdef __NR_epoll_pwait2
+      pwait2_(true)
+#else
+      pwait2_(false)
+#endif
 {
     if(epollfd_ == -1)
         SYSFATAL("EPoller::epoll_create1()");
@@ -23,12 +35,41 @@ EPoller::~EPoller()
     ::close(epollfd_);
 }
 
-void EPoller::poll(ChannelList &activeChannels)
+int EPoller::wait(Nanosecond timeout)
+{
+    int maxEvents = static_cast<int>(events_.size());
+#ifdef __NR_epoll_pwait2
+    if(pwait2_ && timeout > Nanosecond::zero())
+    {
+        struct timespec ts;
+        ts.tv_sec = static_cast<time_t>(timeout.count() / std::nano::den);
+        ts.tv_nsec = timeout.count() % std::nano::den;
+        int n = static_cast<int>(::syscall(
+            __NR_epoll_pwait2, epollfd_, events_.data(), maxEvents,
+            &ts, nullptr, 0
+        ));
+        if(n != -1 || errno != ENOSYS)
+            return n;
+        pwait2_ = false;
+    }
+#endif
+    int timeoutMs = -1;
+    if(timeout >= Nanosecond::zero())
+    {
+        // round up, never return before the timeout
+        auto ms = (timeout + 1ms - 1ns) / 1ms;
+        timeoutMs = ms < INT_MAX ? static_cast<int>(ms): INT_MAX;
+    }
+    return epoll_wait(epollfd_, events_.data(), maxEvents, timeoutMs);
+}
+
+void EPoller::poll(ChannelList &activeChannels, Nanosecond timeout)
 {
     loop_->assertInLoopThread();
+    flushUpdates();
 
     int maxEvents = static_cast<int>(events_.size());
-    int nEvents = epoll_wait(epollfd_, events_.data(), maxEvents, -1);
+    int nEvents = wait(timeout);
     if(nEvents == -1)
     {
         if(errno != EINTR)
@@ -51,33 +92,63 @@ void EPoller::poll(ChannelList &activeChannels)
 void EPoller::updateChannel(Channel *channel)
 {
     loop_->assertInLoopThread();
-    int op = 0;
+    ++numUpdates_;
 
-    if(!channel->polling)
+    if(!channel->isNoneEvents())
     {
-        assert(!channel->isNoneEvents());
-        op = EPOLL_CTL_ADD;
-        channel->polling = true;
+        if(!channel->dirty)
+        {
+            channel->dirty = true;
+            dirtyChannels_.push_back(channel);
+        }
+        return;
     }
-    else if(!channel->isNoneEvents())
+
+    if(channel->dirty)
     {
-        op = EPOLL_CTL_MOD;
+        channel->dirty = false;
+        dirtyChannels_.erase(
+            std::find(dirtyChannels_.begin(), dirtyChannels_.end(), channel)
+        );
     }
-    else
+    if(channel->polling)
     {
-        op = EPOLL_CTL_DEL;
         channel->polling = false;
+        channel->pollingEvents = 0;
+        updateChannel(EPOLL_CTL_DEL, channel);
+    }
+}
+
+void EPoller::flushUpdates()
+{
+    for (auto channel: dirtyChannels_)
+    {
+        assert(channel->dirty && !channel->isNoneEvents());
+        channel->dirty = false;
+
+        if(!channel->polling)
+        {
+            channel->polling = true;
+            updateChannel(EPOLL_CTL_ADD, channel);
+        }
+        else if(channel->events() != channel->pollingEvents)
+        {
+            updateChannel(EPOLL_CTL_MOD, channel);
+        }
+        channel->pollingEvents = channel->events();
     }
-    updateChannel(op, channel);
+    dirtyChannels_.clear();
 }
 
 void EPoller::updateChannel(int op, Channel *channel)
 {
+    ++numEpollCtl_;
     struct epoll_event ee;
     ee.events = channel->events();
     ee.data.ptr = channel;
     int ret = ::epoll_ctl(epollfd_, op, channel->fd(), &ee);
-    if(ret == -1)
+    // a closed fd has already left the epoll set
+    if(ret == -1 && !(op == EPOLL_CTL_DEL && errno == EBADF))
         SYSERR("EPoller::epoll_ctl()");
 }
 
@@ -1,12 +1,11 @@
 #include <cassert>
-#include <mutex>
 #include <sys/eventfd.h>
+#include <sys/prctl.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <syscall.h>
 #include <signal.h>
 #include <numeric>
-#include <vector>
 
 #include "eloop/log.hpp"
 #include "eloop/channel.hpp"
@@ -39,16 +38,57 @@ namespace eloop
 {
 
 EventLoop::EventLoop()
+    : EventLoop(EventLoopOptions())
+{}
+
+EventLoop::EventLoop(PollerBackend backend)
+    : EventLoop(EventLoopOptions{backend})
+{}
+
+EventLoop::EventLoop(const EventLoopOptions &options)
     : tid_(get_tid()),
       quit_(false),
       doingPendingTasks_(false),
-      poller_(this),
+      poller_(Poller::newPoller(
+          this, options.poller, options.ioUringCompletions
+      )),
       wakeupFd_(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
       wakeupChannel_(this, wakeupFd_),
-      timerQueue_(this)
+      wakeupPending_(false),
+      wakeupsIssued_(0),
+      wakeupsSuppressed_(0),
+      spillBuffer_(new char[kSpillBufferSize]),
+      coarseClock_(options.coarseClock),
+      timerSpin_(options.timerSpin),
+      timerSpinning_(false),
+      timerSpins_(0),
+      coarseResolution_(Nanosecond::zero()),
+      now_(clock::monoNow()),
+      iteration_(0),
+      nowLag_(Nanosecond::zero()),
+      timerQueue_(
+          this, options.timers, options.timerTick, options.timerSource
+      ),
+      busyPollBudget_(Nanosecond::zero()),
+      socketBusyPollUs_(0),
+      busyPollSpins_(0),
+      busyPollTransitions_(0)
 {
     if(wakeupFd_ == -1)
         SYSFATAL("EventLoop::eventfd()");
+
+    // the default 50us slack is added to every poller timeout of
+    // the thread
+    if(options.highResTimers && ::prctl(PR_SET_TIMERSLACK, 1UL) == -1)
+        SYSERR("EventLoop::prctl(PR_SET_TIMERSLACK)");
+
+    if(coarseClock_)
+    {
+        struct timespec res;
+        if(::clock_getres(CLOCK_MONOTONIC_COARSE, &res) == -1)
+            SYSFATAL("EventLoop::clock_getres()");
+        coarseResolution_ = Second(res.tv_sec) + Nanosecond(res.tv_nsec);
+    }
     
     wakeupChannel_.setReadCallback(
         [this]()
@@ -76,16 +116,93 @@ void EventLoop::loop()
 
     while (!quit_)
     {
+        Nanosecond timeout = pollTimeout();
         activeChannels_.clear();
-        poller_.poll(activeChannels_);
+        poller_->poll(activeChannels_, timeout);
+        ++iteration_;
+        // after sleeping a tickless kernel may not have updated the
+        // coarse clock yet, so only iterations that spun use it, and
+        // never while spinning for a timer
+        updateNow(
+            coarseClock_ && timeout == Nanosecond::zero() && !timerSpinning_
+        );
+        // what the events queue for the next iteration waits for it
+        runningNextIterationTasks_.swap(nextIterationTasks_);
         for (auto channel: activeChannels_)
             channel->handleEvents();
-        doPendingTasks();
+        size_t numTasks = doNextIterationTasks();
+        if(timerQueue_.drivenByPoll())
+            timerQueue_.runExpired(now_);
+        numTasks += doPendingTasks();
+        doIterationEndTasks();
+
+        if(busyPollBudget_ > Nanosecond::zero() &&
+           (!activeChannels_.empty() || numTasks > 0))
+        {
+            if(timeout != Nanosecond::zero())
+                busyPollTransitions_.fetch_add(1, std::memory_order_relaxed);
+            lastActive_ = now_;
+        }
     }
 
     TRACE("EventLoop %p quit.", this);
 }
 
+void EventLoop::setBusyPoll(Microsecond budget, int socketBusyPollUs)
+{
+    assertInLoopThread();
+    busyPollBudget_ = budget;
+    socketBusyPollUs_ = socketBusyPollUs;
+    lastActive_ = now_;
+}
+
+void EventLoop::updateNow(bool coarse)
+{
+    now_ = coarse ? clock::monoCoarseNow(): clock::monoNow();
+    nowLag_ = coarse ? coarseResolution_: Nanosecond::zero();
+}
+
+MonoTimestamp EventLoop::scheduleNow()
+{
+    if(!isInLoopThread())
+        return clock::monoNow();
+    // a coarse sample may be up to one tick behind, err on late
+    return now_ + nowLag_;
+}
+
+Nanosecond EventLoop::pollTimeout()
+{
+    timerSpinning_ = false;
+    if(!nextIterationTasks_.empty())
+        return Nanosecond::zero();
+    if(busyPollBudget_ > Nanosecond::zero())
+    {
+        auto idle = now_ - lastActive_;
+        if(idle < busyPollBudget_)
+        {
+            busyPollSpins_.fetch_add(1, std::memory_order_relaxed);
+            return Nanosecond::zero();
+        }
+    }
+    if(!timerQueue_.drivenByPoll() && timerSpin_ == Nanosecond::zero())
+        return Nanosecond(-1);
+
+    // callbacks since the last poll may have taken a while
+    updateNow(false);
+    Nanosecond next = timerQueue_.timeUntilNext(now_);
+    if(next < Nanosecond::zero())
+        return Nanosecond(-1);
+    if(next <= timerSpin_)
+    {
+        // too close to sleep through accurately
+        timerSpinning_ = true;
+        timerSpins_.fetch_add(1, std::memory_order_relaxed);
+        return Nanosecond::zero();
+    }
+    // kTimerfd: wake up early to spin, the timerfd still fires
+    return next - timerSpin_;
+}
+
 void EventLoop::quit()
 {
     assert(!quit_);
@@ -94,14 +211,6 @@ void EventLoop::quit()
         wakeup();
 }
 
-void EventLoop::runInLoop(const Task &task)
-{
-    if(isInLoopThread())
-        task();
-    else
-        queueInLoop(task);
-}
-
 void EventLoop::runInLoop(Task &&task)
 {
     if(isInLoopThread())
@@ -110,29 +219,36 @@ void EventLoop::runInLoop(Task &&task)
         queueInLoop(std::move(task));
 }
 
-void EventLoop::queueInLoop(const Task &task)
+void EventLoop::queueInLoop(Task &&task)
 {
-    {
-        std::lock_guard<std::mutex> guard(mutex_);
-        pendingTasks_.push_back(task);
-    }
+    pendingTasks_.push(std::move(task));
     if(!isInLoopThread() || doingPendingTasks_)
         wakeup();
 }
 
+void EventLoop::queueAtIterationEnd(Task &&task)
+{
+    assertInLoopThread();
+    iterationEndTasks_.push_back(std::move(task));
+}
 
-void EventLoop::queueInLoop(Task &&task)
+void EventLoop::queueNextIteration(Task &&task)
 {
-    {
-        std::lock_guard<std::mutex> gard(mutex_);
-        pendingTasks_.push_back(std::move(task));
-    }
-    if(!isInLoopThread() || doingPendingTasks_)
-        wakeup();
+    assertInLoopThread();
+    nextIterationTasks_.push_back(std::move(task));
 }
 
 void EventLoop::wakeup()
 {
+    // only the first wakeup after the loop drained its tasks
+    // has to touch the eventfd, the rest ride along with it.
+    if(wakeupPending_.exchange(true, std::memory_order_acq_rel))
+    {
+        wakeupsSuppressed_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    wakeupsIssued_.fetch_add(1, std::memory_order_relaxed);
+
     uint64_t one = 1;
     ssize_t n = ::write(wakeupFd_, &one, sizeof(one));
     if(n != sizeof(one))
@@ -148,47 +264,76 @@ bool EventLoop::isInLoopThread()
     return tid_ == get_tid();
 }
 
-Timer *EventLoop::runAt(Timestamp when, TimerCallback callback)
+TimerId EventLoop::runAt(
+    Timestamp when,
+    TimerCallback callback,
+    Nanosecond slack
+)
+{
+    return runAt(
+        scheduleNow() + (when - clock::now()),
+        std::move(callback),
+        slack
+    );
+}
+
+TimerId EventLoop::runAt(
+    MonoTimestamp when,
+    TimerCallback callback,
+    Nanosecond slack
+)
 {
     return timerQueue_.addTimer(
         std::move(callback),
         when,
-        Millisecond::zero()
+        Millisecond::zero(),
+        slack
     );
 }
 
-Timer *EventLoop::runAfter(Nanosecond interval, TimerCallback callback)
+TimerId EventLoop::runAfter(
+    Nanosecond interval,
+    TimerCallback callback,
+    Nanosecond slack
+)
 {
     return runAt(
-        clock::now() + interval,
-        std::move(callback)
+        scheduleNow() + interval,
+        std::move(callback),
+        slack
     );
 }
 
-Timer *EventLoop::runEvery(Nanosecond interval, TimerCallback callback)
+TimerId EventLoop::runEvery(
+    Nanosecond interval,
+    TimerCallback callback,
+    Nanosecond slack
+)
 {
     return timerQueue_.addTimer(
         std::move(callback),
-        clock::now() + interval,
-        interval
+        scheduleNow() + interval,
+        interval,
+        slack
     );
 }
 
-void EventLoop::cancelTimer(Timer *timer)
+void EventLoop::cancelTimer(TimerId id)
 {
-    timerQueue_.cancelTimer(timer);
+    timerQueue_.cancelTimer(id);
 }
 
 void EventLoop::updateChannel(Channel *channel)
 {
     assertInLoopThread();
-    poller_.updateChannel(channel);
+    poller_->updateChannel(channel);
 }
 
 void EventLoop::removeChannel(Channel *channel)
 {
     assertInLoopThread();
     channel->disableAll();
+    poller_->removeChannel(channel);
 }
 
 void EventLoop::assertInLoopThread()
@@ -202,20 +347,43 @@ void EventLoop::assertNotInLoopThread()
 }
 
 
-void EventLoop::doPendingTasks()
+size_t EventLoop::doPendingTasks()
 {
     assertInLoopThread();
-    std::vector<Task> tasks;
+    // clear before draining, so a task queued after this point
+    // wakes us again instead of being left behind.
+    wakeupPending_.exchange(false, std::memory_order_acq_rel);
 
+    doingPendingTasks_ = true;
+    size_t n = pendingTasks_.consume(
+        [](Task &task)
+        {
+            task();
+        }
+    );
+    doingPendingTasks_ = false;
+    return n;
+}
+
+void EventLoop::doIterationEndTasks()
+{
+    // tasks may queue more, run those before polling as well
+    while (!iterationEndTasks_.empty())
     {
-        std::lock_guard<std::mutex> guard(mutex_);
-        tasks.swap(pendingTasks_);
+        runningIterationEndTasks_.swap(iterationEndTasks_);
+        for (auto &task: runningIterationEndTasks_)
+            task();
+        runningIterationEndTasks_.clear();
     }
+}
 
-    doingPendingTasks_ = true;
-    for (auto &task: tasks)
+size_t EventLoop::doNextIterationTasks()
+{
+    size_t numTasks = runningNextIterationTasks_.size();
+    for (auto &task: runningNextIterationTasks_)
         task();
-    doingPendingTasks_ = false;
+    runningNextIterationTasks_.clear();
+    return numTasks;
 }
 
 void EventLoop::handleRead()
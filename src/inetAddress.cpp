@@ -0,0 +1,44 @@
+#include <cstring>
+#include <arpa/inet.h>
+#include "eloop/log.hpp"
+#include "eloop/inetAddress.hpp"
+
+
+namespace eloop
+{
+
+InetAddress::InetAddress(uint16_t port, bool loopback)
+{
+    memset(&addr_, 0, sizeof(addr_));
+    addr_.sin_family = AF_INET;
+    addr_.sin_port = htons(port);
+    addr_.sin_addr.s_addr = htonl(loopback ? INADDR_LOOPBACK: INADDR_ANY);
+}
+
+InetAddress::InetAddress(const std::string &ip, uint16_t port)
+{
+    memset(&addr_, 0, sizeof(addr_));
+    addr_.sin_family = AF_INET;
+    addr_.sin_port = htons(port);
+    if(::inet_pton(AF_INET, ip.c_str(), &addr_.sin_addr) != 1)
+        ERROR("InetAddress::inet_pton() bad address %s", ip.c_str());
+}
+
+std::string InetAddress::toIP() const
+{
+    char buf[INET_ADDRSTRLEN];
+    ::inet_ntop(AF_INET, &addr_.sin_addr, buf, sizeof(buf));
+    return buf;
+}
+
+uint16_t InetAddress::toPort() const
+{
+    return ntohs(addr_.sin_port);
+}
+
+std::string InetAddress::toIPPort() const
+{
+    return toIP() + ":" + std::to_string(toPort());
+}
+
+}
@@ -0,0 +1,602 @@
+#include <algorithm>
+#include <cerrno>
+#include <cassert>
+#include <cstring>
+#include <ctime>
+#include <ratio>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include "eloop/log.hpp"
+#include "eloop/channel.hpp"
+#include "eloop/eventLoop.hpp"
+#include "eloop/ioUringPoller.hpp"
+
+
+namespace
+{
+
+const unsigned kRingEntries = 256;
+
+int ioUringSetup(unsigned entries, struct io_uring_params *params)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(
+    int fd, unsigned toSubmit, unsigned minComplete,
+    unsigned flags, const void *arg, size_t argSize
+)
+{
+    return static_cast<int>(::syscall(
+        __NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize
+    ));
+}
+
+int ioUringRegister(int fd, unsigned opcode, void *arg, unsigned nrArgs)
+{
+    return static_cast<int>(::syscall(
+        __NR_io_uring_register, fd, opcode, arg, nrArgs
+    ));
+}
+
+// EXT_ARG: timeout passed to io_uring_enter, 5.11
+// RSRC_TAGS: 5.13, IORING_OP_POLL_REMOVE by user_data is older
+const unsigned kRequiredFeatures =
+    IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS;
+
+}
+
+namespace eloop
+{
+
+bool IOUringPoller::supported()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = ioUringSetup(1, &params);
+    if(fd == -1)
+        return false;
+    ::close(fd);
+    return (params.features & kRequiredFeatures) == kRequiredFeatures;
+}
+
+IOUringPoller::IOUringPoller(EventLoop *loop, bool completions)
+    : loop_(loop),
+      ringfd_(-1),
+      toSubmit_(0),
+      bufferRing_(nullptr),
+      recvBuffers_(nullptr),
+      bufferTail_(0),
+      nextToken_(kIgnoreToken + 1)
+{
+    // only the loop thread submits, and it reaps completions in
+    // every iteration anyway, no need to be interrupted for them (6.0)
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    ringfd_ = ioUringSetup(kRingEntries, &params);
+    if(ringfd_ == -1 && errno == EINVAL)
+    {
+        memset(&params, 0, sizeof(params));
+        ringfd_ = ioUringSetup(kRingEntries, &params);
+    }
+    if(ringfd_ == -1)
+        SYSFATAL("IOUringPoller::io_uring_setup()");
+    assert(params.features & IORING_FEAT_SINGLE_MMAP);
+
+    sqEntries_ = params.sq_entries;
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    if(cqRingSize_ > sqRingSize_)
+        sqRingSize_ = cqRingSize_;
+    cqRingSize_ = sqRingSize_;
+
+    sqRing_ = ::mmap(
+        nullptr, sqRingSize_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_SQ_RING
+    );
+    if(sqRing_ == MAP_FAILED)
+        SYSFATAL("IOUringPoller::mmap() sq ring");
+    // single mmap covers both rings
+    cqRing_ = sqRing_;
+
+    void *sqes = ::mmap(
+        nullptr, params.sq_entries * sizeof(struct io_uring_sqe),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ringfd_, IORING_OFF_SQES
+    );
+    if(sqes == MAP_FAILED)
+        SYSFATAL("IOUringPoller::mmap() sqes");
+    sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+    char *sq = static_cast<char*>(sqRing_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+    char *cq = static_cast<char*>(cqRing_);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    if(completions && !setupBufferRing())
+        WARN("IOUringPoller no multishot recv, readiness only");
+}
+
+IOUringPoller::~IOUringPoller()
+{
+    if(bufferRing_ != nullptr)
+    {
+        ::munmap(bufferRing_, kRecvBuffers * sizeof(struct io_uring_buf));
+        ::munmap(recvBuffers_, kRecvBuffers * kRecvBufferSize);
+    }
+    ::munmap(sqes_, sqEntries_ * sizeof(struct io_uring_sqe));
+    ::munmap(sqRing_, sqRingSize_);
+    ::close(ringfd_);
+}
+
+// Buffers multishot recv picks from (5.19). Each one goes back to the
+// ring once the channel it was handed to had its events handled.
+bool IOUringPoller::setupBufferRing()
+{
+    static_assert(
+        (kRecvBuffers & (kRecvBuffers - 1)) == 0,
+        "buffer ring size must be a power of two"
+    );
+    size_t ringSize = kRecvBuffers * sizeof(struct io_uring_buf);
+    void *ring = ::mmap(
+        nullptr, ringSize, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+    );
+    if(ring == MAP_FAILED)
+        return false;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+    reg.ring_entries = kRecvBuffers;
+    reg.bgid = kRecvBufferGroup;
+    if(ioUringRegister(ringfd_, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+    {
+        ::munmap(ring, ringSize);
+        return false;
+    }
+    // buffer rings came first, without multishot recv (6.0) every
+    // recv would fail
+    if(!multishotRecvSupported())
+    {
+        struct io_uring_buf_reg unreg;
+        memset(&unreg, 0, sizeof(unreg));
+        unreg.bgid = kRecvBufferGroup;
+        ioUringRegister(ringfd_, IORING_UNREGISTER_PBUF_RING, &unreg, 1);
+        ::munmap(ring, ringSize);
+        return false;
+    }
+
+    void *buffers = ::mmap(
+        nullptr, kRecvBuffers * kRecvBufferSize, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+    );
+    if(buffers == MAP_FAILED)
+        SYSFATAL("IOUringPoller::mmap() recv buffers");
+
+    bufferRing_ = static_cast<struct io_uring_buf*>(ring);
+    recvBuffers_ = static_cast<char*>(buffers);
+    for (unsigned i = 0; i < kRecvBuffers; i++)
+        usedBuffers_.push_back(static_cast<uint16_t>(i));
+    recycleBuffers();
+    return true;
+}
+
+// Older kernels reject the flag when the recv is prepared, newer ones
+// leave it pending on the empty socket until canceled.
+bool IOUringPoller::multishotRecvSupported()
+{
+    int fds[2];
+    if(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+    {
+        SYSERR("IOUringPoller::socketpair()");
+        return false;
+    }
+
+    const uint64_t token = nextToken_++;
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fds[0];
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = kRecvBufferGroup;
+    sqe->user_data = token;
+
+    sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = token;
+    sqe->user_data = kIgnoreToken;
+
+    // the recv and the cancel both complete
+    int res = 0;
+    unsigned completed = 0;
+    while (completed < 2)
+    {
+        enter(1, Nanosecond(-1));
+        unsigned head = *cqHead_;
+        unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head, ++completed)
+        {
+            const struct io_uring_cqe &cqe = cqes_[head & *cqMask_];
+            if(cqe.user_data == token)
+                res = cqe.res;
+        }
+        __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    }
+    ::close(fds[0]);
+    ::close(fds[1]);
+    return res != -EINVAL;
+}
+
+void IOUringPoller::recycleBuffers()
+{
+    if(usedBuffers_.empty())
+        return;
+    for (auto bid: usedBuffers_)
+    {
+        struct io_uring_buf &buf =
+            bufferRing_[bufferTail_ & (kRecvBuffers - 1)];
+        buf.addr = reinterpret_cast<uint64_t>(
+            recvBuffers_ + static_cast<size_t>(bid) * kRecvBufferSize
+        );
+        buf.len = kRecvBufferSize;
+        buf.bid = bid;
+        ++bufferTail_;
+    }
+    // the tail overlays the first entry's resv field
+    __atomic_store_n(&bufferRing_[0].resv, bufferTail_, __ATOMIC_RELEASE);
+    usedBuffers_.clear();
+}
+
+struct io_uring_sqe *IOUringPoller::getSqe()
+{
+    unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    unsigned tail = *sqTail_;
+    if(tail - head >= sqEntries_)
+    {
+        // ring full, hand what we have to the kernel
+        enter(0, Nanosecond::zero());
+        head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+        assert(tail - head < sqEntries_);
+    }
+
+    unsigned index = tail & *sqMask_;
+    struct io_uring_sqe *sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray_[index] = index;
+    __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+    ++toSubmit_;
+    return sqe;
+}
+
+void IOUringPoller::enter(unsigned minComplete, Nanosecond timeout)
+{
+    unsigned flags = 0;
+    const void *arg = nullptr;
+    size_t argSize = 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg ext;
+
+    if(minComplete > 0)
+    {
+        flags |= IORING_ENTER_GETEVENTS;
+        if(timeout >= Nanosecond::zero())
+        {
+            ts.tv_sec = timeout.count() / std::nano::den;
+            ts.tv_nsec = timeout.count() % std::nano::den;
+            memset(&ext, 0, sizeof(ext));
+            ext.ts = reinterpret_cast<uint64_t>(&ts);
+            flags |= IORING_ENTER_EXT_ARG;
+            arg = &ext;
+            argSize = sizeof(ext);
+        }
+    }
+
+    int ret = ioUringEnter(
+        ringfd_, toSubmit_, minComplete, flags, arg, argSize
+    );
+    if(ret == -1)
+    {
+        // ETIME: timed out, EINTR: signal, EBUSY: completions pending
+        if(errno != ETIME && errno != EINTR && errno != EBUSY)
+            SYSFATAL("IOUringPoller::io_uring_enter()");
+        return;
+    }
+    assert(static_cast<unsigned>(ret) <= toSubmit_);
+    toSubmit_ -= static_cast<unsigned>(ret);
+}
+
+void IOUringPoller::poll(ChannelList &activeChannels, Nanosecond timeout)
+{
+    loop_->assertInLoopThread();
+
+    // every handler of the last batch has run, its buffers are free
+    if(bufferRing_ != nullptr)
+        recycleBuffers();
+
+    for (auto channel: rearm_)
+    {
+        auto it = registrations_.find(channel);
+        if(it != registrations_.end())
+            update(channel, it->second);
+    }
+    rearm_.clear();
+
+    unsigned head = *cqHead_;
+    bool ready = head != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    if(!ready && timeout != Nanosecond::zero())
+        enter(1, timeout);
+    else if(toSubmit_ > 0)
+        enter(0, Nanosecond::zero());
+
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head)
+    {
+        const struct io_uring_cqe &cqe = cqes_[head & *cqMask_];
+        if(cqe.user_data == kIgnoreToken)
+            continue;
+
+        auto it = tokens_.find(cqe.user_data);
+        if(it == tokens_.end())
+            continue;   // canceled
+        if(it->second.op != Channel::CompletionOp::kNone)
+        {
+            Request request = it->second;
+            if(!(cqe.flags & IORING_CQE_F_MORE))
+                tokens_.erase(it);
+            handleCompletion(cqe, request, activeChannels);
+            continue;
+        }
+
+        Channel *channel = it->second.channel;
+        tokens_.erase(it);
+        Registration &reg = registrations_[channel];
+        reg.armed = false;
+
+        unsigned revents;
+        if(cqe.res < 0)
+        {
+            errno = -cqe.res;
+            SYSERR("IOUringPoller::poll fd=%d", channel->fd());
+            revents = EPOLLERR;
+        }
+        else
+        {
+            revents = static_cast<unsigned>(cqe.res);
+            // the recv reports the end of the stream itself
+            if(reg.opArmed)
+                revents &= ~EPOLLHUP;
+        }
+        report(channel, activeChannels);
+        channel->setRevents(channel->revents() | revents);
+        rearm_.push_back(channel);
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+
+    for (auto channel: activeChannels)
+        channel->reported = false;
+}
+
+void IOUringPoller::handleCompletion(
+    const struct io_uring_cqe &cqe,
+    Request request,
+    ChannelList &activeChannels
+)
+{
+    const char *data = nullptr;
+    if(cqe.flags & IORING_CQE_F_BUFFER)
+    {
+        uint16_t bid = static_cast<uint16_t>(
+            cqe.flags >> IORING_CQE_BUFFER_SHIFT
+        );
+        usedBuffers_.push_back(bid);
+        data = recvBuffers_ + static_cast<size_t>(bid) * kRecvBufferSize;
+    }
+
+    Channel *channel = request.channel;
+    bool accept = request.op == Channel::CompletionOp::kAccept;
+    if(channel == nullptr)
+    {
+        // removed, nobody takes the connection
+        if(accept && cqe.res >= 0)
+            ::close(cqe.res);
+        return;
+    }
+
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    auto it = registrations_.find(channel);
+    if(!more && it != registrations_.end())
+    {
+        Registration &reg = it->second;
+        auto &ops = reg.opTokens;
+        ops.erase(
+            std::remove(ops.begin(), ops.end(), cqe.user_data), ops.end()
+        );
+        if(reg.opArmed && reg.opToken == cqe.user_data)
+        {
+            // The multishot ended on its own. Out of buffers or a
+            // full CQ, go on next poll; a stream that ended or failed
+            // is left to the channel.
+            reg.opArmed = false;
+            if(accept || cqe.res > 0 || cqe.res == -ENOBUFS)
+                rearm_.push_back(channel);
+        }
+    }
+
+    if(cqe.res == -ECANCELED || cqe.res == -ENOBUFS)
+        return;
+    channel->addCompletion(cqe.res, data);
+    report(channel, activeChannels);
+}
+
+void IOUringPoller::report(Channel *channel, ChannelList &activeChannels)
+{
+    if(channel->reported)
+        return;
+    channel->reported = true;
+    channel->setRevents(0);
+    activeChannels.push_back(channel);
+}
+
+void IOUringPoller::updateChannel(Channel *channel)
+{
+    loop_->assertInLoopThread();
+
+    if(!channel->polling)
+    {
+        if(channel->isNoneEvents())
+            return;
+        channel->polling = true;
+        Registration &reg = registrations_[channel];
+        reg.armed = false;
+        reg.opArmed = false;
+        update(channel, reg);
+        return;
+    }
+
+    auto it = registrations_.find(channel);
+    assert(it != registrations_.end());
+    Registration &reg = it->second;
+    // the poll mask changes, the multishot only needs to follow reading
+    if(reg.armed)
+        cancel(reg);
+    update(channel, reg);
+
+    // with results in flight the channel stays known until removed
+    if(channel->isNoneEvents() && reg.opTokens.empty())
+    {
+        channel->polling = false;
+        registrations_.erase(it);
+    }
+}
+
+void IOUringPoller::removeChannel(Channel *channel)
+{
+    loop_->assertInLoopThread();
+    auto it = registrations_.find(channel);
+    if(it == registrations_.end())
+        return;
+    Registration &reg = it->second;
+    if(reg.armed)
+        cancel(reg);
+    if(reg.opArmed)
+        cancelOp(reg);
+    // late results of the fd are dropped
+    for (auto token: reg.opTokens)
+    {
+        auto request = tokens_.find(token);
+        if(request != tokens_.end())
+            request->second.channel = nullptr;
+    }
+    registrations_.erase(it);
+    rearm_.erase(
+        std::remove(rearm_.begin(), rearm_.end(), channel), rearm_.end()
+    );
+    channel->polling = false;
+}
+
+// Bring the kernel side in line with what channel wants: a poll for
+// the readiness events, a multishot for reading in completion mode.
+void IOUringPoller::update(Channel *channel, Registration &reg)
+{
+    unsigned events = channel->events() & ~EPOLLET;
+    bool completion = completionIO() &&
+        channel->completionOp() != Channel::CompletionOp::kNone;
+    if(completion)
+    {
+        events &= ~(EPOLLIN | EPOLLPRI);
+        bool reading = channel->isReading();
+        if(reading && !reg.opArmed)
+            armOp(channel, reg);
+        else if(!reading && reg.opArmed)
+            cancelOp(reg);
+    }
+    if(events != 0 && !reg.armed)
+        arm(channel, reg);
+}
+
+void IOUringPoller::arm(Channel *channel, Registration &reg)
+{
+    assert(!reg.armed);
+    reg.token = nextToken_++;
+    reg.armed = true;
+    tokens_[reg.token] = {channel, Channel::CompletionOp::kNone};
+
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = channel->fd();
+    // one-shot polls are re-armed each time, EPOLLET has no meaning
+    sqe->poll32_events = channel->events() & ~EPOLLET;
+    if(reg.opArmed)
+        sqe->poll32_events &= ~(EPOLLIN | EPOLLPRI);
+    sqe->user_data = reg.token;
+}
+
+void IOUringPoller::cancel(Registration &reg)
+{
+    assert(reg.armed);
+    reg.armed = false;
+    tokens_.erase(reg.token);
+
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = reg.token;
+    sqe->user_data = kIgnoreToken;
+}
+
+void IOUringPoller::armOp(Channel *channel, Registration &reg)
+{
+    assert(!reg.opArmed);
+    reg.opToken = nextToken_++;
+    reg.opArmed = true;
+    reg.opTokens.push_back(reg.opToken);
+    tokens_[reg.opToken] = {channel, channel->completionOp()};
+
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->fd = channel->fd();
+    sqe->user_data = reg.opToken;
+    if(channel->completionOp() == Channel::CompletionOp::kAccept)
+    {
+        // no peer address with multishot, getpeername() if needed
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    }
+    else
+    {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = kRecvBufferGroup;
+    }
+}
+
+// Data taken off the socket before the cancel lands is still handed
+// to the channel, the token stays until the last completion.
+void IOUringPoller::cancelOp(Registration &reg)
+{
+    assert(reg.opArmed);
+    reg.opArmed = false;
+
+    struct io_uring_sqe *sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = reg.opToken;
+    sqe->user_data = kIgnoreToken;
+}
+
+}
@@ -0,0 +1,23 @@
+#include "eloop/log.hpp"
+#include "eloop/epoller.hpp"
+#include "eloop/ioUringPoller.hpp"
+#include "eloop/poller.hpp"
+
+
+namespace eloop
+{
+
+std::unique_ptr<Poller> Poller::newPoller(
+    EventLoop *loop, PollerBackend backend, bool completions
+)
+{
+    if(backend == PollerBackend::kIOUring)
+    {
+        if(IOUringPoller::supported())
+            return std::make_unique<IOUringPoller>(loop, completions);
+        WARN("Poller::newPoller io_uring unavailable, fall back to epoll");
+    }
+    return std::make_unique<EPoller>(loop);
+}
+
+}
@@ -0,0 +1,121 @@
+#include <cstring>
+#include <new>
+#include "eloop/buffer.hpp"
+#include "eloop/slice.hpp"
+
+
+namespace eloop
+{
+
+// refcount and bytes in one allocation
+struct Slice::CopyStorage: Slice::Storage
+{
+    char *bytes()
+    {
+        return reinterpret_cast<char*>(this + 1);
+    }
+
+    static void free(Storage *storage)
+    {
+        auto self = static_cast<CopyStorage*>(storage);
+        self->~CopyStorage();
+        ::operator delete(self);
+    }
+};
+
+struct Slice::StringStorage: Slice::Storage
+{
+    std::string str;
+
+    static void free(Storage *storage)
+    {
+        delete static_cast<StringStorage*>(storage);
+    }
+};
+
+struct Slice::BufferStorage: Slice::Storage
+{
+    Buffer buffer;
+
+    static void free(Storage *storage)
+    {
+        delete static_cast<BufferStorage*>(storage);
+    }
+};
+
+struct Slice::BorrowStorage: Slice::Storage
+{
+    std::shared_ptr<const void> guard;
+
+    static void free(Storage *storage)
+    {
+        delete static_cast<BorrowStorage*>(storage);
+    }
+};
+
+Slice::Slice(const char *data, size_t len)
+    : Slice()
+{
+    if(len == 0)
+        return;
+    void *mem = ::operator new(sizeof(CopyStorage) + len);
+    auto storage = new (mem) CopyStorage;
+    storage->refs.store(1, std::memory_order_relaxed);
+    storage->destroy = CopyStorage::free;
+    memcpy(storage->bytes(), data, len);
+    storage_ = storage;
+    data_ = storage->bytes();
+    size_ = len;
+}
+
+Slice::Slice(std::string &&str)
+    : Slice()
+{
+    if(str.empty())
+        return;
+    auto storage = new StringStorage;
+    storage->refs.store(1, std::memory_order_relaxed);
+    storage->destroy = StringStorage::free;
+    storage->str = std::move(str);
+    storage_ = storage;
+    data_ = storage->str.data();
+    size_ = storage->str.size();
+}
+
+Slice::Slice(Buffer &&buffer)
+    : Slice()
+{
+    if(buffer.readableBytes() == 0)
+        return;
+    auto storage = new BufferStorage;
+    storage->refs.store(1, std::memory_order_relaxed);
+    storage->destroy = BufferStorage::free;
+    storage->buffer.swap(buffer);
+    // Slices travel to other threads and may outlive the loop whose
+    // pool the storage came from
+    storage->buffer.detachPool();
+    storage_ = storage;
+    data_ = storage->buffer.peek();
+    size_ = storage->buffer.readableBytes();
+}
+
+Slice Slice::borrow(
+    const char *data,
+    size_t len,
+    std::shared_ptr<const void> guard
+)
+{
+    Slice slice;
+    if(len == 0)
+        return slice;
+    auto storage = new BorrowStorage;
+    storage->refs.store(1, std::memory_order_relaxed);
+    storage->destroy = BorrowStorage::free;
+    storage->guard = std::move(guard);
+    slice.storage_ = storage;
+    slice.data_ = data;
+    slice.size_ = len;
+    return slice;
+}
+
+}
@@ -39,24 +39,6 @@ ThreadPool::~ThreadPool()
     TRACE("~ThreadPool()");
 }
 
-void ThreadPool::runTask(const Task &task)
-{
-    assert(running_);
-    
-    if(threads_.empty())
-    {
-        task();
-    }
-    else
-    {
-        std::unique_lock<std::mutex> lck(mutex_);
-        while (taskQueue_.size() >= maxQueueSize_)
-            notFull_.wait(lck);
-        taskQueue_.push_back(task);
-        notEmpty_.notify_one();
-    }
-}
-
 void ThreadPool::runTask(Task &&task)
 {
     assert(running_);
@@ -70,7 +52,7 @@ void ThreadPool::runTask(Task &&task)
         std::unique_lock<std::mutex> lck(mutex_);
         while (taskQueue_.size() >= maxQueueSize_)
             notFull_.wait(lck);
-        taskQueue_.push_back(task);
+        taskQueue_.push_back(std::move(task));
         notEmpty_.notify_one();
     }
 }
@@ -109,7 +91,7 @@ Task ThreadPool::take()
     Task task;
     if(!taskQueue_.empty())
     {
-        task = taskQueue_.front();
+        task = std::move(taskQueue_.front());
         taskQueue_.pop_front();
         notFull_.notify_one();
     }
@@ -1,12 +1,14 @@
 #include <sys/timerfd.h>
 #include <strings.h>
 #include <unistd.h>
+#include <algorithm>
 #include <ratio>
 
 #include "eloop/log.hpp"
 #include "eloop/eventLoop.hpp"
 #include "eloop/timestamp.hpp"
 #include "eloop/timer.hpp"
+#include "eloop/timingWheel.hpp"
 #include "eloop/timerQueue.hpp"
 
 
@@ -32,27 +34,19 @@ void timerfdRead(int fd)
         eloop::ERROR("TimerfdRead get %ld, not %lu", n, sizeof(val));
 }
 
-struct timespec durationFromNow(eloop::Timestamp when)
+void timerfdSet(int fd, eloop::MonoTimestamp when)
 {
-    using namespace eloop;
-    struct timespec ret;
-    eloop::Nanosecond ns = when - clock::now();
-    if(ns < 1ms)
-        ns = 1ms;
-    
-    ret.tv_sec = static_cast<time_t>(ns.count() / std::nano::den);
-    ret.tv_nsec = ns.count() % std::nano::den;
-    return ret;
-}
-
-void timerfdSet(int fd, eloop::Timestamp when)
-{
-    struct itimerspec oldTime, newTime;
-    bzero(&oldTime, sizeof(oldTime));
+    // absolute CLOCK_MONOTONIC deadline, no clock read needed and a
+    // deadline already passed fires right away
+    struct itimerspec newTime;
     bzero(&newTime, sizeof(newTime));
-    newTime.it_value = durationFromNow(when);
+    int64_t ns = when.time_since_epoch().count();
+    if(ns <= 0)
+        ns = 1;
+    newTime.it_value.tv_sec = static_cast<time_t>(ns / std::nano::den);
+    newTime.it_value.tv_nsec = ns % std::nano::den;
 
-    int ret = timerfd_settime(fd, 0, &newTime, &oldTime);
+    int ret = timerfd_settime(fd, TFD_TIMER_ABSTIME, &newTime, nullptr);
     if(ret == -1)
         eloop::SYSERR("timerfd_settime()");
 }
@@ -62,69 +56,188 @@ void timerfdSet(int fd, eloop::Timestamp when)
 namespace eloop
 {
 
-TimerQueue::TimerQueue(EventLoop *loop)
-    : loop_(loop),
-      timerfd_(timerfdCreate()),
-      timerChannel_(loop, timerfd_)
+TimerQueue::TimerQueue(
+    EventLoop *loop,
+    TimerBackend backend,
+    Nanosecond tick,
+    TimerSource source
+): loop_(loop),
+   source_(source),
+   timerfd_(source == TimerSource::kTimerfd ? timerfdCreate(): -1),
+   timerChannel_(loop, timerfd_),
+   armed_(MonoTimestamp::min()),
+   timerWakeups_(0),
+   timersFired_(0)
 {
+    if(backend == TimerBackend::kTimingWheel)
+        timers_ = std::make_unique<TimingWheel>(loop->now(), tick);
+    else
+        timers_ = std::make_unique<TimerSet>();
+
     loop_->assertInLoopThread();
-    timerChannel_.setReadCallback(
-        [this]()
+    if(source_ == TimerSource::kTimerfd)
+    {
+        timerChannel_.setReadCallback(
+            [this]()
+            {
+                handleRead();
+            }
+        );
+        timerChannel_.enableRead();
+    }
+}
+
+TimerQueue::~TimerQueue()
+{
+    // timers are owned by chunks_
+    if(timerfd_ != -1)
+        ::close(timerfd_);
+}
+
+Timer *TimerQueue::allocTimer()
+{
+    std::lock_guard<std::mutex> guard(poolMutex_);
+    if(freeSlots_.empty())
+    {
+        uint32_t base = static_cast<uint32_t>(chunks_.size()) * kChunkSize;
+        chunks_.emplace_back(new Timer[kChunkSize]);
+        Timer *chunk = chunks_.back().get();
+        for (uint32_t i = kChunkSize; i > 0; --i)
         {
-            handleRead();
+            chunk[i - 1].poolIndex = base + i - 1;
+            freeSlots_.push_back(base + i - 1);
         }
-    );
-    timerChannel_.enableRead();
+    }
+
+    uint32_t index = freeSlots_.back();
+    freeSlots_.pop_back();
+    return &chunks_[index / kChunkSize][index % kChunkSize];
 }
 
-TimerQueue::~TimerQueue()
+void TimerQueue::freeTimer(Timer *timer)
+{
+    assert(!timer->stored);
+    timer->clear();
+    std::lock_guard<std::mutex> guard(poolMutex_);
+    // outstanding TimerIds become stale
+    ++timer->poolGeneration;
+    freeSlots_.push_back(timer->poolIndex);
+}
+
+Timer *TimerQueue::findTimer(TimerId id)
+{
+    std::lock_guard<std::mutex> guard(poolMutex_);
+    if(!id.valid() || id.index() / kChunkSize >= chunks_.size())
+        return nullptr;
+    Timer *timer = &chunks_[id.index() / kChunkSize][id.index() % kChunkSize];
+    if(timer->poolGeneration != id.generation())
+        return nullptr;
+    return timer;
+}
+
+void TimerQueue::insert(Timer *timer)
 {
-    for(auto &p: timers_)
-        delete p.second;
-    ::close(timerfd_);
+    bool earliest = timers_->empty() ||
+        timer->expiration() < timers_->nextExpiration();
+    timers_->insert(timer);
+    timer->stored = true;
+    if(earliest && source_ == TimerSource::kTimerfd)
+        arm(timers_->nextExpiration());
 }
 
-Timer *TimerQueue::addTimer(
+TimerId TimerQueue::addTimer(
     TimerCallback cb,
-    Timestamp when,
-    Nanosecond interval
+    MonoTimestamp when,
+    Nanosecond interval,
+    Nanosecond slack
 )
 {
-    Timer *timer = new Timer(std::move(cb), when, interval);
+    Timer *timer = allocTimer();
+    timer->reset(std::move(cb), when, interval, slack);
+    TimerId id(timer->poolIndex, timer->poolGeneration);
     loop_->runInLoop(
-        [=]()
+        [this, timer]()
         {
-            auto ret = timers_.insert({when, timer});
-            assert(ret.second);
-
-            if(timers_.begin() == ret.first)
-                timerfdSet(timerfd_, when);
+            // canceled before it got here
+            if(timer->canceled())
+                freeTimer(timer);
+            else
+                insert(timer);
         }
     );
-    return timer;
+    return id;
 }
 
-void TimerQueue::cancelTimer(Timer *timer)
+void TimerQueue::cancelTimer(TimerId id)
 {
     loop_->runInLoop(
-        [timer, this]()
+        [this, id]()
         {
+            Timer *timer = findTimer(id);
+            if(timer == nullptr || timer->canceled())
+                return;
             timer->cancel();
-            timers_.erase({timer->when(), timer});
-            delete timer;
+            // otherwise it is running or waiting to be inserted,
+            // and is freed there
+            if(timer->stored)
+            {
+                timers_->erase(timer);
+                timer->stored = false;
+                freeTimer(timer);
+            }
         }
     );
 }
 
+Nanosecond TimerQueue::timeUntilNext(MonoTimestamp now) const
+{
+    loop_->assertInLoopThread();
+    if(timers_->empty())
+        return Nanosecond(-1);
+
+    Nanosecond ns = timers_->nextExpiration() - now;
+    return ns > Nanosecond::zero() ? ns: Nanosecond::zero();
+}
+
+void TimerQueue::runExpired(MonoTimestamp now)
+{
+    assert(source_ == TimerSource::kPollTimeout);
+    loop_->assertInLoopThread();
+    if(!timers_->empty() && timers_->nextExpiration() <= now)
+        expire(now);
+}
+
 void TimerQueue::handleRead()
 {
     loop_->assertInLoopThread();
     timerfdRead(timerfd_);
+    // the timerfd firing proves armed_ has passed, even if the
+    // loop's cached (possibly coarse) clock has not caught up yet
+    expire(std::max(loop_->now(), armed_));
+
+    if(!timers_->empty())
+        arm(timers_->nextExpiration());
+}
+
+void TimerQueue::arm(MonoTimestamp when)
+{
+    armed_ = when;
+    timerfdSet(timerfd_, when);
+}
 
-    Timestamp now(clock::now());
-    for(auto &e: getExpired(now))
+void TimerQueue::expire(MonoTimestamp now)
+{
+    expired_.clear();
+    timers_->popExpired(now, expired_);
+    for(auto timer: expired_)
+        timer->stored = false;
+    if(!expired_.empty())
+    {
+        ++timerWakeups_;
+        timersFired_ += expired_.size();
+    }
+    for(auto timer: expired_)
     {
-        Timer *timer = e.second;
         assert(timer->expired(now));
 
         if(!timer->canceled())
@@ -132,29 +245,14 @@ void TimerQueue::handleRead()
         if(!timer->canceled() && timer->repeat())
         {
             timer->restart();
-            e.first = timer->when();
-            timers_.insert(e);
+            timers_->insert(timer);
+            timer->stored = true;
         }
         else
         {
-            delete timer;
+            freeTimer(timer);
         }
     }
-
-    if(!timers_.empty())
-        timerfdSet(timerfd_, timers_.begin()->first);
-}
-
-std::vector<TimerQueue::Entry>
-TimerQueue::getExpired(Timestamp now)
-{
-    Entry en(now + 1ns, nullptr);
-    std::vector<Entry> entries;
-
-    auto end = timers_.lower_bound(en);
-    entries.assign(timers_.begin(), end);
-    timers_.erase(timers_.begin(), end);
-    return entries;
 }
 
 }
@@ -0,0 +1,235 @@
+#include <cassert>
+#include "eloop/timingWheel.hpp"
+
+
+namespace
+{
+
+// bits of occupied strictly above index
+uint64_t slotsAbove(uint64_t occupied, uint64_t index)
+{
+    if(index + 1 >= eloop::TimingWheel::kSlots)
+        return 0;
+    return occupied & (~0ULL << (index + 1));
+}
+
+}
+
+namespace eloop
+{
+
+TimingWheel::TimingWheel(MonoTimestamp start, Nanosecond tick)
+    : start_(start),
+      tick_(tick),
+      current_(0),
+      size_(0),
+      ready_(nullptr),
+      overflow_(nullptr)
+{
+    assert(tick_ > Nanosecond::zero());
+    for (int l = 0; l < kLevels; l++)
+    {
+        occupied_[l] = 0;
+        for (int i = 0; i < kSlots; i++)
+            slots_[l][i] = nullptr;
+    }
+}
+
+uint64_t TimingWheel::tickOf(MonoTimestamp when) const
+{
+    // round up, a timer never fires early
+    if(when <= start_)
+        return 0;
+    uint64_t ns = static_cast<uint64_t>((when - start_).count());
+    uint64_t tick = static_cast<uint64_t>(tick_.count());
+    return (ns + tick - 1) / tick;
+}
+
+MonoTimestamp TimingWheel::timeOf(uint64_t tick) const
+{
+    return start_ + Nanosecond(tick * tick_.count());
+}
+
+void TimingWheel::insert(Timer *timer)
+{
+    assert(timer->wheelSlot == nullptr);
+    timer->wheelTick = tickOf(timer->expiration());
+    place(timer);
+    ++size_;
+}
+
+void TimingWheel::erase(Timer *timer)
+{
+    if(timer->wheelSlot == nullptr)
+        return;
+    unlink(timer);
+    --size_;
+}
+
+void TimingWheel::place(Timer *timer)
+{
+    uint64_t t = timer->wheelTick;
+    if(t <= current_)
+    {
+        link(&ready_, timer);
+        return;
+    }
+
+    // lowest level whose higher bits match the current tick
+    for (int l = 0; l < kLevels; l++)
+    {
+        int shift = kLevelBits * (l + 1);
+        if((t >> shift) == (current_ >> shift))
+        {
+            uint64_t index = (t >> (kLevelBits * l)) & (kSlots - 1);
+            link(&slots_[l][index], timer);
+            occupied_[l] |= 1ULL << index;
+            return;
+        }
+    }
+    link(&overflow_, timer);
+}
+
+void TimingWheel::link(Timer **slot, Timer *timer)
+{
+    timer->wheelSlot = slot;
+    timer->wheelPrev = nullptr;
+    timer->wheelNext = *slot;
+    if(*slot != nullptr)
+        (*slot)->wheelPrev = timer;
+    *slot = timer;
+}
+
+void TimingWheel::unlink(Timer *timer)
+{
+    Timer **slot = timer->wheelSlot;
+    if(timer->wheelPrev != nullptr)
+        timer->wheelPrev->wheelNext = timer->wheelNext;
+    else
+        *slot = timer->wheelNext;
+    if(timer->wheelNext != nullptr)
+        timer->wheelNext->wheelPrev = timer->wheelPrev;
+    timer->wheelSlot = nullptr;
+    timer->wheelPrev = nullptr;
+    timer->wheelNext = nullptr;
+
+    if(*slot == nullptr && slot != &ready_ && slot != &overflow_)
+    {
+        size_t i = static_cast<size_t>(slot - &slots_[0][0]);
+        occupied_[i / kSlots] &= ~(1ULL << (i % kSlots));
+    }
+}
+
+void TimingWheel::moveAll(Timer **slot, std::vector<Timer*> &out)
+{
+    Timer *timer = *slot;
+    while (timer != nullptr)
+    {
+        Timer *next = timer->wheelNext;
+        unlink(timer);
+        out.push_back(timer);
+        --size_;
+        timer = next;
+    }
+}
+
+void TimingWheel::cascade(Timer **slot)
+{
+    Timer *timer = *slot;
+    while (timer != nullptr)
+    {
+        Timer *next = timer->wheelNext;
+        unlink(timer);
+        place(timer);
+        timer = next;
+    }
+}
+
+void TimingWheel::advance()
+{
+    // top down, so a timer can fall through several levels at once
+    const int topShift = kLevelBits * kLevels;
+    if((current_ & ((1ULL << topShift) - 1)) == 0)
+        cascade(&overflow_);
+    for (int l = kLevels - 1; l >= 1; --l)
+    {
+        int shift = kLevelBits * l;
+        if((current_ & ((1ULL << shift) - 1)) == 0)
+            cascade(&slots_[l][(current_ >> shift) & (kSlots - 1)]);
+    }
+}
+
+void TimingWheel::popExpired(MonoTimestamp now, std::vector<Timer*> &expired)
+{
+    uint64_t nowTick = 0;
+    if(now > start_)
+        nowTick = static_cast<uint64_t>((now - start_).count()) /
+            static_cast<uint64_t>(tick_.count());
+
+    moveAll(&ready_, expired);
+    while (current_ < nowTick)
+    {
+        if(size_ == 0)
+        {
+            current_ = nowTick;
+            break;
+        }
+
+        // jump to the next occupied level 0 slot or the next
+        // level 0 revolution, whichever comes first
+        uint64_t ahead = slotsAbove(occupied_[0], current_ & (kSlots - 1));
+        uint64_t next = ahead != 0
+            ? (current_ & ~static_cast<uint64_t>(kSlots - 1)) +
+                static_cast<uint64_t>(__builtin_ctzll(ahead))
+            : (current_ | (kSlots - 1)) + 1;
+        if(next > nowTick)
+        {
+            current_ = nowTick;
+            break;
+        }
+
+        current_ = next;
+        advance();
+        moveAll(&slots_[0][current_ & (kSlots - 1)], expired);
+        moveAll(&ready_, expired);
+    }
+}
+
+void TimingWheel::popAll(std::vector<Timer*> &all)
+{
+    moveAll(&ready_, all);
+    moveAll(&overflow_, all);
+    for (int l = 0; l < kLevels; l++)
+    {
+        for (int i = 0; i < kSlots; i++)
+            moveAll(&slots_[l][i], all);
+    }
+    assert(size_ == 0);
+}
+
+MonoTimestamp TimingWheel::nextExpiration() const
+{
+    assert(size_ > 0);
+    if(ready_ != nullptr)
+        return timeOf(current_);
+
+    for (int l = 0; l < kLevels; l++)
+    {
+        int shift = kLevelBits * l;
+        uint64_t index = (current_ >> shift) & (kSlots - 1);
+        uint64_t ahead = slotsAbove(occupied_[l], index);
+        if(ahead != 0)
+        {
+            int upper = kLevelBits * (l + 1);
+            uint64_t tick = ((current_ >> upper) << upper) |
+                (static_cast<uint64_t>(__builtin_ctzll(ahead)) << shift);
+            return timeOf(tick);
+        }
+    }
+
+    const int topShift = kLevelBits * kLevels;
+    assert(overflow_ != nullptr);
+    return timeOf(((current_ >> topShift) + 1) << topShift);
+}
+
+}